@@ -0,0 +1,268 @@
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <fstream>
+#include <iterator>
+#include <map>
+#include <string>
+#include <vector>
+
+#include <fmt/format.h>
+
+#include "core/decoder.h"
+
+namespace {
+    constexpr uint16_t program_start = 0x200;
+    constexpr int max_block_length = 32;
+
+    struct Block {
+        uint16_t end = 0;
+        std::string body;
+    };
+
+    class Translator {
+        public:
+        explicit Translator(const std::vector<uint8_t>& rom) : rom_size(rom.size()) {
+            std::copy(rom.begin(), rom.end(), memory.begin() + program_start);
+        }
+
+        // Recovers the control-flow graph reachable from 0x200
+        void translate() {
+            std::vector<uint16_t> worklist{program_start};
+            while(!worklist.empty()) {
+                const uint16_t address = worklist.back();
+                worklist.pop_back();
+                if(!inRom(address) || blocks.count(address)) {
+                    continue;
+                }
+                blocks[address] = translateBlock(address, worklist);
+            }
+        }
+
+        std::string output(const std::string& rom_name) const {
+            std::string out = fmt::format("// Generated by pof-aot from {}, do not edit\n", rom_name);
+            out += "#include \"core/aot.h\"\n\nnamespace {\n\nconst uint8_t rom[] = {";
+            for(std::size_t i = 0; i < rom_size; i++) {
+                out += fmt::format("{}0x{:02X},", i % 16 ? " " : "\n    ", memory[program_start + i]);
+            }
+            out += "\n};\n\n";
+
+            for(const auto& [address, block] : blocks) {
+                // blocks of one instruction never check the budget
+                out += fmt::format("uint32_t block_{:03X}(AotContext& ctx, [[maybe_unused]] uint32_t budget) {{\n", address);
+                out += "    [[maybe_unused]] uint16_t& pc = *ctx.pc;\n";
+                out += "    [[maybe_unused]] uint16_t& I = *ctx.I;\n";
+                out += "    [[maybe_unused]] uint8_t* const V = ctx.V;\n\n";
+                out += block.body;
+                out += "}\n\n";
+            }
+
+            out += "const AotBlock blocks[] = {\n";
+            for(const auto& [address, block] : blocks) {
+                out += fmt::format("    {{0x{:03X}, 0x{:03X}, block_{:03X}}},\n", address, block.end, address);
+            }
+            out += "};\n\n";
+            out += "const AotProgram program = {rom, sizeof(rom), blocks, sizeof(blocks) / sizeof(blocks[0])};\n\n";
+            out += "} // Anonymous namespace\n\n";
+            out += "POF_AOT_EXPORT const AotProgram* pofAotProgram() {\n    return &program;\n}\n";
+            return out;
+        }
+
+        std::size_t blockCount() const {
+            return blocks.size();
+        }
+
+        private:
+        bool inRom(uint32_t address) const {
+            return address >= program_start && address < program_start + rom_size;
+        }
+
+        Block translateBlock(uint16_t start, std::vector<uint16_t>& worklist) const {
+            Block block;
+            std::string& body = block.body;
+            uint32_t address = start;
+            int length = 0;
+            bool ended = false;
+
+            while(!ended && length < max_block_length && inRom(address)) {
+                const Instruction insty(memory[address], memory[(address+1) & 0xFFF]);
+                const DecodedInstruction d = decode(insty);
+                const uint16_t next = address + 2;
+
+                if(length > 0) {
+                    body += fmt::format("    if(budget <= {}) {{\n        pc = 0x{:03X};\n        return {};\n    }}\n", length, address, length);
+                }
+                length++;
+                body += fmt::format("    // {:03X}: {:04X}\n", address, insty.whole);
+
+                const auto terminate = [&](const std::string& pc_expression) {
+                    body += fmt::format("    pc = {};\n    return {};\n", pc_expression, length);
+                    ended = true;
+                };
+                const auto skip = [&](const std::string& condition) {
+                    terminate(fmt::format("({}) ? 0x{:03X} : 0x{:03X}", condition, next + 2, next));
+                    worklist.push_back(next);
+                    worklist.push_back(next + 2);
+                };
+
+                switch(d.op) {
+                    case Op::SetImm:
+                        body += fmt::format("    V[0x{:X}] = 0x{:02X};\n", d.x, d.nn);
+                        break;
+                    case Op::AddImm:
+                        body += fmt::format("    V[0x{:X}] += 0x{:02X};\n", d.x, d.nn);
+                        break;
+                    case Op::SetReg:
+                        body += fmt::format("    V[0x{:X}] = V[0x{:X}];\n", d.x, d.y);
+                        break;
+                    case Op::Or:
+                        body += fmt::format("    V[0x{:X}] |= V[0x{:X}];\n", d.x, d.y);
+                        break;
+                    case Op::And:
+                        body += fmt::format("    V[0x{:X}] &= V[0x{:X}];\n", d.x, d.y);
+                        break;
+                    case Op::Xor:
+                        body += fmt::format("    V[0x{:X}] ^= V[0x{:X}];\n", d.x, d.y);
+                        break;
+                    case Op::AddReg:
+                        body += fmt::format("    {{\n        const unsigned sum = V[0x{0:X}] + V[0x{1:X}];\n"
+                                            "        V[0xF] = sum > 255;\n        V[0x{0:X}] = sum & 0xFF;\n    }}\n", d.x, d.y);
+                        break;
+                    case Op::SubReg:
+                    case Op::SubnReg:
+                    {
+                        const bool reverse = d.op == Op::SubnReg;
+                        body += fmt::format("    {{\n        const uint8_t vx = V[0x{:X}];\n        const uint8_t vy = V[0x{:X}];\n"
+                                            "        V[0x{:X}] = {};\n        V[0xF] = {};\n    }}\n",
+                                            d.x, d.y, d.x, reverse ? "vy - vx" : "vx - vy", reverse ? "vy >= vx" : "vx >= vy");
+                        break;
+                    }
+                    case Op::SetIndex:
+                        body += fmt::format("    I = 0x{:03X};\n", d.nnn);
+                        break;
+                    case Op::AddIndex:
+                        body += fmt::format("    I += V[0x{:X}];\n", d.x);
+                        break;
+                    case Op::GetDelay:
+                        body += fmt::format("    V[0x{:X}] = *ctx.delay_timer;\n", d.x);
+                        break;
+                    case Op::SetDelay:
+                        body += fmt::format("    *ctx.delay_timer = V[0x{:X}];\n", d.x);
+                        break;
+                    case Op::Jump:
+                        if(d.nnn == address) {
+                            // a jump to itself goes through the interpreter, which reports the halt
+                            body += fmt::format("    pc = 0x{:03X};\n    ctx.execute(ctx.chip, 0x{:04X});\n    return {};\n",
+                                                next, insty.whole, length);
+                            ended = true;
+                            break;
+                        }
+                        terminate(fmt::format("0x{:03X}", d.nnn));
+                        worklist.push_back(d.nnn);
+                        break;
+                    case Op::SkipEqualImm:
+                        skip(fmt::format("V[0x{:X}] == 0x{:02X}", d.x, d.nn));
+                        break;
+                    case Op::SkipNotEqualImm:
+                        skip(fmt::format("V[0x{:X}] != 0x{:02X}", d.x, d.nn));
+                        break;
+                    case Op::SkipEqualReg:
+                        skip(d.x == d.y ? "true" : fmt::format("V[0x{:X}] == V[0x{:X}]", d.x, d.y));
+                        break;
+                    case Op::SkipNotEqualReg:
+                        skip(d.x == d.y ? "false" : fmt::format("V[0x{:X}] != V[0x{:X}]", d.x, d.y));
+                        break;
+                    default:
+                        // everything else goes through the interpreter handlers
+                        body += fmt::format("    pc = 0x{:03X};\n", next);
+                        switch(d.op) {
+                            case Op::Call:
+                                worklist.push_back(d.nnn);
+                                worklist.push_back(next);
+                                ended = true;
+                                break;
+                            case Op::SkipKey:
+                            case Op::SkipNotKey:
+                                worklist.push_back(next + 2);
+                                worklist.push_back(next);
+                                ended = true;
+                                break;
+                            case Op::WaitKey:
+                                worklist.push_back(address);
+                                [[fallthrough]];
+                            // these may rewrite the code that follows
+                            case Op::Bcd:
+                            case Op::Store:
+                                worklist.push_back(next);
+                                ended = true;
+                                break;
+                            case Op::Return:
+                            case Op::JumpOffset:
+                                ended = true;
+                                break;
+                            default:
+                                break;
+                        }
+                        if(ended) {
+                            body += fmt::format("    ctx.execute(ctx.chip, 0x{:04X});\n    return {};\n", insty.whole, length);
+                        }
+                        else {
+                            body += fmt::format("    if(ctx.execute(ctx.chip, 0x{:04X})) {{\n        return {};\n    }}\n",
+                                                insty.whole, length);
+                        }
+                        break;
+                }
+
+                address = next;
+            }
+
+            if(!ended) {
+                body += fmt::format("    pc = 0x{:03X};\n    return {};\n", address, length);
+                worklist.push_back(address);
+            }
+            block.end = std::min<uint32_t>(address, 4096);
+            return block;
+        }
+
+        std::array<uint8_t, 4096> memory{};
+        std::size_t rom_size;
+        std::map<uint16_t, Block> blocks;
+    };
+
+    void printHelp(const char* argv0) {
+        fmt::print("Usage: {} <rom> <output.cpp>\n"
+                   "Translates a CHIP-8 program into C++ to be built as an AOT plugin\n",
+                   argv0);
+    }
+} // Anonymous namespace
+
+int main(int argc, char* args[]) {
+    if (argc != 3) {
+        printHelp(args[0]);
+        return -1;
+    }
+
+    std::ifstream file(args[1], std::ios::in | std::ios::binary);
+    if (!file.is_open()) {
+        fmt::print("Could not open {}\n", args[1]);
+        return -1;
+    }
+    const std::vector<uint8_t> rom{std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>()};
+    if (rom.empty() || rom.size() >= 4096 - program_start) {
+        fmt::print("{} is not a CHIP-8 program\n", args[1]);
+        return -1;
+    }
+
+    Translator translator(rom);
+    translator.translate();
+
+    std::ofstream output(args[2]);
+    output << translator.output(args[1]);
+    if (!output) {
+        fmt::print("Could not write {}\n", args[2]);
+        return -1;
+    }
+    fmt::print("Translated {} blocks\n", translator.blockCount());
+
+    return 0;
+}
@@ -0,0 +1,316 @@
+#undef _UNICODE
+#include <getopt.h>
+#ifndef _MSC_VER
+#include <unistd.h>
+#endif
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <fmt/core.h>
+
+#include "core/batch.h"
+#include "core/chip8.h"
+#include "pof/frame_pixels.h"
+
+namespace {
+    constexpr uint16_t program_start = 0x200;
+
+    std::vector<uint8_t> toBytes(const std::vector<uint16_t>& opcodes) {
+        std::vector<uint8_t> bytes;
+        for (const uint16_t opcode : opcodes) {
+            bytes.push_back(opcode >> 8);
+            bytes.push_back(opcode & 0xFF);
+        }
+        return bytes;
+    }
+
+    // A program that runs setup once, and then body repeated to fill a loop
+    std::vector<uint8_t> loopProgram(const std::vector<uint16_t>& setup, const std::vector<uint16_t>& body) {
+        constexpr int repeats = 32;
+        std::vector<uint16_t> program = setup;
+        const uint16_t loop_start = program_start + 2*program.size();
+        for (int i = 0; i < repeats; i++) {
+            program.insert(program.end(), body.begin(), body.end());
+        }
+        program.push_back(0x1000 | loop_start);
+        return toBytes(program);
+    }
+
+    // A machine that has run the setup of loopProgram
+    std::unique_ptr<Chip8> loopMachine(const std::vector<uint16_t>& setup, const std::vector<uint16_t>& body,
+                                       CpuBackend backend = CpuBackend::Switch) {
+        auto chip = std::make_unique<Chip8>();
+        chip->setSeed(1);
+        chip->setCpuBackend(backend);
+        chip->loadProgram(loopProgram(setup, body));
+        for (std::size_t i = 0; i < setup.size(); i++) {
+            chip->fetchDecodeExecute();
+        }
+        return chip;
+    }
+
+    // Returns the ops it ran
+    using Step = std::function<uint64_t()>;
+
+    std::function<Step()> singleSteps(std::vector<uint16_t> setup, std::vector<uint16_t> body) {
+        return [setup, body] {
+            std::shared_ptr<Chip8> chip = loopMachine(setup, body);
+            return [chip] {
+                constexpr uint64_t steps = 1000;
+                for (uint64_t i = 0; i < steps; i++) {
+                    chip->fetchDecodeExecute();
+                }
+                return steps;
+            };
+        };
+    }
+
+    std::function<Step()> ticks(std::vector<uint16_t> setup, std::vector<uint16_t> body, CpuBackend backend) {
+        return [setup, body, backend] {
+            std::shared_ptr<Chip8> chip = loopMachine(setup, body, backend);
+            return [chip] {
+                constexpr uint32_t cycles = 10000;
+                chip->tickCPU(cycles);
+                return uint64_t{cycles};
+            };
+        };
+    }
+
+    // ops are lane instructions, the same work as lanes machines of ticks
+    std::function<Step()> batchTicks(std::vector<uint16_t> setup, std::vector<uint16_t> body, std::size_t lanes) {
+        return [setup, body, lanes] {
+            auto batch = std::make_shared<Chip8Batch>(lanes);
+            batch->setSeed(1);
+            batch->loadProgram(loopProgram(setup, body));
+            batch->tickCPU(setup.size());
+            return [batch, lanes] {
+                constexpr uint32_t cycles = 1000;
+                batch->tickCPU(cycles);
+                return uint64_t{cycles} * lanes;
+            };
+        };
+    }
+
+    // what batchTicks replaces, one machine after another
+    std::function<Step()> separateTicks(std::vector<uint16_t> setup, std::vector<uint16_t> body, std::size_t lanes) {
+        return [setup, body, lanes] {
+            auto chips = std::make_shared<std::vector<std::unique_ptr<Chip8>>>();
+            for (std::size_t lane = 0; lane < lanes; lane++) {
+                chips->push_back(loopMachine(setup, body));
+                chips->back()->setSeed(1 + lane);
+            }
+            return [chips, lanes] {
+                constexpr uint32_t cycles = 1000;
+                for (const auto& chip : *chips) {
+                    chip->tickCPU(cycles);
+                }
+                return uint64_t{cycles} * lanes;
+            };
+        };
+    }
+
+    struct Benchmark {
+        std::string name;
+        std::function<Step()> make; // builds a fresh machine for each run
+    };
+
+    std::vector<Benchmark> benchmarks() {
+        std::vector<Benchmark> list;
+        const auto single = [&list](std::string name, std::vector<uint16_t> setup, std::vector<uint16_t> body) {
+            list.push_back({"fde/" + name, singleSteps(std::move(setup), std::move(body))});
+        };
+
+        // one class of opcode at a time through fetchDecodeExecute
+        single("6XNN-set", {}, {0x6012});
+        single("7XNN-add", {}, {0x7001});
+        single("8XY0-move", {}, {0x8010});
+        single("8XY2-and", {}, {0x8012});
+        single("8XY4-add", {0x6107}, {0x8014});
+        single("8XY5-sub", {0x6107}, {0x8015});
+        single("8XY6-shift", {0x60F0}, {0x8016});
+        single("3XNN-skip-not-taken", {}, {0x3001});
+        single("4XNN-skip-taken", {}, {0x4001, 0x0000});
+        single("ANNN-index", {}, {0xA300});
+        single("FX1E-add-index", {0xA000, 0x6001}, {0xF01E});
+        single("FX29-font", {0x6007}, {0xF029});
+        single("CXNN-random", {}, {0xC0FF});
+        single("FX07-get-delay", {}, {0xF007});
+        single("FX15-set-delay", {}, {0xF015});
+        single("EX9E-key", {}, {0xE09E});
+        single("2NNN-00EE-call-return", {0x1206, 0x00EE, 0x0000}, {0x2202});
+
+        // sprite heights and clipping at the right and bottom edges
+        for (const uint8_t height : {1, 5, 8, 15}) {
+            single(fmt::format("DXYN-h{}", height), {0x6010, 0x6108, 0xA200}, {static_cast<uint16_t>(0xD010 | height)});
+        }
+        single("DXYN-h8-clip-right", {0x603C, 0x6108, 0xA200}, {0xD018});
+        single("DXYN-h8-clip-bottom", {0x6010, 0x611C, 0xA200}, {0xD018});
+        single("DXYN-h8-clip-corner", {0x603C, 0x611C, 0xA200}, {0xD018});
+        single("00E0-clear", {}, {0x00E0});
+
+        // memory access, the stores also invalidate decoded code
+        single("FX33-bcd", {0x60FE, 0xA600}, {0xF033});
+        single("FX55-store-16", {0xA600}, {0xFF55});
+        single("FX65-load-16", {0xA600}, {0xFF65});
+
+        // opcode mixes through tickCPU on every backend
+        const std::vector<std::pair<std::string, CpuBackend>> backends = {
+            {"switch", CpuBackend::Switch},
+            {"threaded", CpuBackend::Threaded},
+            {"jit", CpuBackend::Jit},
+        };
+        for (const auto& [backend_name, backend] : backends) {
+            // moves a sprite across the screen, reading keys and the delay timer
+            list.push_back({"tick/game/" + backend_name, ticks({0x6A00, 0x6B08, 0xA200},
+                {0xDAB5, 0x7A01, 0x4A40, 0x6A00, 0xE19E, 0x7B01, 0xF007, 0x8AB4, 0x4B20, 0x6B00, 0xDAB5}, backend)});
+            // counting loops and table lookups that fuse into superinstructions
+            list.push_back({"tick/alu/" + backend_name, ticks({0x6000, 0x6100},
+                {0x7001, 0x8014, 0x8102, 0xA300, 0xF11E, 0xF165, 0x8014, 0x6205, 0x6303, 0x8234, 0x8235}, backend)});
+        }
+
+        // many machines on one program, in lockstep while they agree and
+        // split up by random skips
+        constexpr std::size_t lanes = 256;
+        const std::vector<uint16_t> game_setup = {0x6A00, 0x6B08, 0xA200};
+        const std::vector<uint16_t> game = {0xDAB5, 0x7A01, 0x4A40, 0x6A00, 0xE19E, 0x7B01, 0xF007, 0x8AB4, 0x4B20, 0x6B00, 0xDAB5};
+        const std::vector<uint16_t> diverging = {0xC101, 0x3100, 0x7A01, 0x8AB4, 0xC203, 0x4200, 0xDAB5, 0x7B01, 0xA300, 0xF21E};
+        list.push_back({"batch/uniform/batch", batchTicks(game_setup, game, lanes)});
+        list.push_back({"batch/uniform/separate", separateTicks(game_setup, game, lanes)});
+        list.push_back({"batch/diverging/batch", batchTicks(game_setup, diverging, lanes)});
+        list.push_back({"batch/diverging/separate", separateTicks(game_setup, diverging, lanes)});
+
+        // the frontend's conversion of the screen to pixels, per frame
+        list.push_back({"present/expand-frame", [] {
+            std::shared_ptr<Chip8> chip = loopMachine({0xA000}, {0xC03F, 0xC11F, 0xD015});
+            for (int i = 0; i < 200; i++) {
+                chip->fetchDecodeExecute();
+            }
+            auto pixels = std::make_shared<std::array<uint32_t, nWidth*nHeight>>();
+            return Step([chip, pixels] {
+                expandFrame(*chip, pixels->data(), 0xFF008F11, 0xFF000000);
+                return uint64_t{1};
+            });
+        }});
+        return list;
+    }
+
+    // Runs step until min_seconds have passed, returns nanoseconds per op
+    double measure(const Step& step, double min_seconds) {
+        using namespace std::chrono;
+        step(); // decodes, compiles and warms the caches
+
+        uint64_t ops = 0;
+        double elapsed = 0;
+        const auto start = steady_clock::now();
+        while (elapsed < min_seconds) {
+            ops += step();
+            elapsed = duration<double>(steady_clock::now() - start).count();
+        }
+        return elapsed * 1e9 / ops;
+    }
+
+    std::map<std::string, double> readResults(const std::string& filename) {
+        std::map<std::string, double> results;
+        std::ifstream file(filename);
+        if (!file.is_open()) {
+            fmt::print("Could not open {}\n", filename);
+        }
+        std::string name;
+        double ns;
+        while (file >> name >> ns) {
+            results[name] = ns;
+        }
+        return results;
+    }
+
+    void printHelp(const char* argv0) {
+        fmt::print("Usage: {} [options]\n"
+                   "Measures the core hot paths in nanoseconds per op\n"
+                   "-h, --help            Display this help text and exit\n"
+                   "--filter=<text>       Only run benchmarks whose name contains text\n"
+                   "--time=<seconds>      Time spent on each benchmark, default 0.2\n"
+                   "--save=<file>         Write the results, to compare against later\n"
+                   "--baseline=<file>     Compare with results written by --save\n",
+                   argv0);
+    }
+} // Anonymous namespace
+
+int main(int argc, char* args[]) {
+    int option_index = 0;
+
+    std::string filter;
+    double min_seconds = 0.2;
+    std::string save_file;
+    std::string baseline_file;
+
+    static struct option long_options[] = {
+        {"help", no_argument, 0, 'h'},
+        {"filter", required_argument, 0, 'f'},
+        {"time", required_argument, 0, 't'},
+        {"save", required_argument, 0, 's'},
+        {"baseline", required_argument, 0, 'b'},
+        {0, 0, 0, 0},
+    };
+
+    int arg;
+    while ((arg = getopt_long(argc, args, "h", long_options, &option_index)) != -1) {
+        switch (static_cast<char>(arg)) {
+        case 'h':
+            printHelp(args[0]);
+            return 0;
+        case 'f':
+            filter = optarg;
+            break;
+        case 't':
+            min_seconds = std::strtod(optarg, nullptr);
+            break;
+        case 's':
+            save_file = optarg;
+            break;
+        case 'b':
+            baseline_file = optarg;
+            break;
+        default:
+            printHelp(args[0]);
+            return -1;
+        }
+    }
+
+    const std::map<std::string, double> baseline = baseline_file.empty()
+        ? std::map<std::string, double>{} : readResults(baseline_file);
+    std::ofstream save;
+    if (!save_file.empty()) {
+        save.open(save_file);
+        if (!save.is_open()) {
+            fmt::print("Could not write {}\n", save_file);
+            return -1;
+        }
+    }
+
+    for (const Benchmark& benchmark : benchmarks()) {
+        if (benchmark.name.find(filter) == std::string::npos) {
+            continue;
+        }
+        const double ns = measure(benchmark.make(), min_seconds);
+        std::string line = fmt::format("{:<36} {:>10.2f} ns/op", benchmark.name, ns);
+        const auto previous = baseline.find(benchmark.name);
+        if (previous != baseline.end() && previous->second > 0) {
+            line += fmt::format("  {:+6.1f}% vs {:.2f}", 100.0 * (ns - previous->second) / previous->second, previous->second);
+        }
+        fmt::print("{}\n", line);
+        if (save.is_open()) {
+            save << benchmark.name << ' ' << fmt::format("{:.3f}", ns) << '\n';
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,308 @@
+#undef _UNICODE
+#include <getopt.h>
+#ifndef _MSC_VER
+#include <unistd.h>
+#endif
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <iterator>
+#include <memory>
+#include <optional>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <fmt/core.h>
+
+#include "core/chip8.h"
+#include "core/input_script.h"
+
+namespace {
+    // One line of the manifest
+    struct Entry {
+        std::string rom;
+        uint64_t frames = 600;
+        std::string input;
+        Quirks quirks = default_quirks;
+        std::string quirks_name = "modern";
+        int frequency = 0; // 0 keeps the core default
+        uint32_t seed = 0;
+        std::optional<uint64_t> hash;
+
+        // filled in before the run
+        std::vector<uint8_t> program;
+        std::vector<InputEvent> events;
+        std::string error;
+    };
+
+    struct Result {
+        uint64_t frames = 0;
+        uint64_t instructions = 0;
+        double seconds = 0;
+        uint64_t hash = 0;
+    };
+
+    bool parseManifestLine(const std::string& line, Entry& entry, std::string& error) {
+        std::istringstream fields(line);
+        if (!(fields >> entry.rom)) {
+            return false;
+        }
+        std::string field;
+        while (fields >> field) {
+            const auto equals = field.find('=');
+            const std::string name = field.substr(0, equals);
+            const std::string value = equals == std::string::npos ? "" : field.substr(equals + 1);
+            if (value.empty()) {
+                error = fmt::format("expected <name>=<value>, got {}", field);
+            } else if (name == "frames") {
+                entry.frames = std::strtoull(value.c_str(), nullptr, 10);
+            } else if (name == "input") {
+                entry.input = value;
+            } else if (name == "quirks") {
+                const auto quirks = quirksFromName(value);
+                if (!quirks) {
+                    error = fmt::format("unknown quirks profile {}", value);
+                }
+                entry.quirks = quirks.value_or(default_quirks);
+                entry.quirks_name = value;
+            } else if (name == "frequency") {
+                entry.frequency = std::atoi(value.c_str());
+            } else if (name == "seed") {
+                entry.seed = static_cast<uint32_t>(std::strtoul(value.c_str(), nullptr, 10));
+            } else if (name == "hash") {
+                entry.hash = std::strtoull(value.c_str(), nullptr, 16);
+            } else {
+                error = fmt::format("unknown field {}", name);
+            }
+        }
+        return true;
+    }
+
+    bool readManifest(const std::string& filename, std::vector<Entry>& entries) {
+        std::ifstream file(filename);
+        if (!file.is_open()) {
+            fmt::print("Could not open {}\n", filename);
+            return false;
+        }
+        std::string line;
+        for (int number = 1; std::getline(file, line); number++) {
+            Entry entry;
+            std::string error;
+            if (!parseManifestLine(line.substr(0, line.find('#')), entry, error)) {
+                continue;
+            }
+            if (!error.empty()) {
+                fmt::print("{}:{}: {}\n", filename, number, error);
+                return false;
+            }
+            entries.push_back(std::move(entry));
+        }
+        return true;
+    }
+
+    // Reads the program and input script of an entry, paths are relative to the ROM directory
+    void prepare(Entry& entry, const std::string& rom_dir) {
+        const std::string path = rom_dir + "/" + entry.rom;
+        std::ifstream file(path, std::ios::in | std::ios::binary);
+        if (!file.is_open()) {
+            entry.error = fmt::format("could not open {}", path);
+            return;
+        }
+        entry.program.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+        if (entry.program.empty() || entry.program.size() > 4096 - 512) {
+            entry.error = fmt::format("{} is not a CHIP-8 program", path);
+            return;
+        }
+        if (!entry.input.empty() && !readInputScript(rom_dir + "/" + entry.input, entry.events)) {
+            entry.error = fmt::format("could not read input script {}", entry.input);
+        }
+    }
+
+    // Runs an entry uncapped on a machine of its own
+    Result run(const Entry& entry, CpuBackend backend) {
+        auto chip = std::make_unique<Chip8>();
+        chip->setQuirks(entry.quirks);
+        chip->setSeed(entry.seed);
+        if (entry.frequency > 0) {
+            chip->setCoreFrequency(entry.frequency);
+        }
+        chip->setCpuBackend(backend);
+        chip->loadProgram(entry.program);
+
+        Result result;
+        const auto start = std::chrono::steady_clock::now();
+        auto next_input = entry.events.begin();
+        while (result.frames < entry.frames) {
+            for (; next_input != entry.events.end() && next_input->frame <= result.frames; ++next_input) {
+                chip->setKey(next_input->key, next_input->pressed);
+            }
+            result.instructions += chip->runTick().cycles;
+            result.frames++;
+            if (!chip->isRunning() || chip->isHalted()) {
+                break;
+            }
+        }
+        result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        result.hash = chip->frameHash();
+        return result;
+    }
+
+    void printHelp(const char* argv0) {
+        fmt::print("Usage: {} [options] <rom-dir> <manifest>\n"
+                   "Runs every ROM of a manifest in parallel and checks its final framebuffer hash\n"
+                   "Manifest lines: <rom> [frames=n] [input=script] [quirks=profile] [frequency=hz] [seed=n] hash=<hex>\n"
+                   "-h, --help            Display this help text and exit\n"
+                   "--jobs=<n>            Worker threads, default one per core\n"
+                   "--cpu=<backend>       CPU backend: switch (default), threaded or jit\n"
+                   "--record              Print the manifest with the hashes of this run instead of checking\n",
+                   argv0);
+    }
+} // Anonymous namespace
+
+int main(int argc, char* args[]) {
+    int option_index = 0;
+
+    std::vector<std::string> positional;
+    unsigned jobs = std::max(1u, std::thread::hardware_concurrency());
+    CpuBackend backend = CpuBackend::Switch;
+    bool record = false;
+
+    static struct option long_options[] = {
+        {"help", no_argument, 0, 'h'},
+        {"jobs", required_argument, 0, 'j'},
+        {"cpu", required_argument, 0, 'c'},
+        {"record", no_argument, 0, 'r'},
+        {0, 0, 0, 0},
+    };
+
+    while (optind < argc) {
+        int arg = getopt_long(argc, args, "h", long_options, &option_index);
+        if (arg != -1) {
+            switch (static_cast<char>(arg)) {
+            case 'h':
+                printHelp(args[0]);
+                return 0;
+            case 'j':
+                jobs = std::max(1, std::atoi(optarg));
+                break;
+            case 'c': {
+                const auto cpu = cpuBackendFromName(optarg);
+                if (!cpu) {
+                    fmt::print("Unknown cpu backend {}\n", optarg);
+                    printHelp(args[0]);
+                    return -1;
+                }
+                backend = *cpu;
+                break;
+            }
+            case 'r':
+                record = true;
+                break;
+            default:
+                printHelp(args[0]);
+                return -1;
+            }
+        } else {
+            positional.assign(args + optind, args + argc);
+            break;
+        }
+    }
+
+    if (positional.size() != 2) {
+        printHelp(args[0]);
+        return -1;
+    }
+    const std::string& rom_dir = positional[0];
+
+    std::vector<Entry> entries;
+    if (!readManifest(positional[1], entries)) {
+        return -1;
+    }
+    for (Entry& entry : entries) {
+        prepare(entry, rom_dir);
+    }
+
+    // workers take the next entry until none are left, every run has its own machine
+    std::vector<Result> results(entries.size());
+    std::atomic<std::size_t> next_entry{0};
+    const auto start = std::chrono::steady_clock::now();
+    std::vector<std::thread> workers;
+    for (unsigned i = 0; i < std::min<std::size_t>(jobs, entries.size()); i++) {
+        workers.emplace_back([&] {
+            for (std::size_t index = next_entry++; index < entries.size(); index = next_entry++) {
+                if (entries[index].error.empty()) {
+                    results[index] = run(entries[index], backend);
+                }
+            }
+        });
+    }
+    for (std::thread& worker : workers) {
+        worker.join();
+    }
+    const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    if (record) {
+        for (std::size_t i = 0; i < entries.size(); i++) {
+            const Entry& entry = entries[i];
+            if (!entry.error.empty()) {
+                fmt::print("# {}: {}\n", entry.rom, entry.error);
+                continue;
+            }
+            std::string line = fmt::format("{} frames={}", entry.rom, entry.frames);
+            if (!entry.input.empty()) {
+                line += fmt::format(" input={}", entry.input);
+            }
+            if (entry.quirks != default_quirks) {
+                line += fmt::format(" quirks={}", entry.quirks_name);
+            }
+            if (entry.frequency > 0) {
+                line += fmt::format(" frequency={}", entry.frequency);
+            }
+            if (entry.seed != 0) {
+                line += fmt::format(" seed={}", entry.seed);
+            }
+            fmt::print("{} hash={:016x}\n", line, results[i].hash);
+        }
+        return 0;
+    }
+
+    std::size_t passed = 0;
+    std::size_t mismatched = 0;
+    std::size_t errors = 0;
+    uint64_t instructions = 0;
+    for (std::size_t i = 0; i < entries.size(); i++) {
+        const Entry& entry = entries[i];
+        const Result& result = results[i];
+        if (!entry.error.empty()) {
+            fmt::print("ERROR     {}: {}\n", entry.rom, entry.error);
+            errors++;
+            continue;
+        }
+        instructions += result.instructions;
+        const double rate = result.seconds > 0 ? result.instructions / result.seconds : 0.0;
+        if (!entry.hash) {
+            fmt::print("ERROR     {}: no expected hash, got {:016x}\n", entry.rom, result.hash);
+            errors++;
+        } else if (*entry.hash != result.hash) {
+            fmt::print("MISMATCH  {}: expected {:016x}, got {:016x} after {} frames\n",
+                       entry.rom, *entry.hash, result.hash, result.frames);
+            mismatched++;
+        } else {
+            fmt::print("ok        {}: {} frames, {} instructions, {:.0f} instructions per second\n",
+                       entry.rom, result.frames, result.instructions, rate);
+            passed++;
+        }
+    }
+
+    fmt::print("passed: {}, mismatched: {}, errors: {}\n", passed, mismatched, errors);
+    fmt::print("jobs: {}, seconds: {:.2f}, instructions per second: {:.0f}\n",
+               std::min<std::size_t>(jobs, entries.size()), seconds, seconds > 0 ? instructions / seconds : 0.0);
+
+    return mismatched == 0 && errors == 0 ? 0 : 1;
+}
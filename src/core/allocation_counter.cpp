@@ -0,0 +1,141 @@
+#include "allocation_counter.h"
+
+// Built as its own object library, since replacing the global allocation
+// functions reaches every allocation of the program that links it.
+#ifndef NDEBUG
+#include <algorithm>
+#include <cstdlib>
+#include <new>
+#ifdef _MSC_VER
+#include <malloc.h>
+#endif
+
+namespace {
+    thread_local std::size_t allocations = 0;
+
+    std::size_t countAllocations() {
+        return allocations;
+    }
+
+    // hands the count to NoAllocationScope as the program starts
+    struct InstallCount {
+        InstallCount() {
+            allocation_count = countAllocations;
+        }
+    } install_count;
+
+    void* allocate(std::size_t size) noexcept {
+        allocations++;
+        return std::malloc(size ? size : 1);
+    }
+
+    void* allocate(std::size_t size, std::align_val_t alignment) noexcept {
+        allocations++;
+        const std::size_t align = static_cast<std::size_t>(alignment);
+#ifdef _MSC_VER
+        return _aligned_malloc(size ? size : 1, align);
+#else
+        // aligned_alloc takes a whole number of alignments
+        return std::aligned_alloc(align, (std::max<std::size_t>(size, 1) + align - 1) / align * align);
+#endif
+    }
+
+    void deallocate(void* pointer, std::align_val_t) noexcept {
+#ifdef _MSC_VER
+        _aligned_free(pointer);
+#else
+        std::free(pointer);
+#endif
+    }
+
+    template<typename... Alignment>
+    void* allocateOrThrow(std::size_t size, Alignment... alignment) {
+        void* pointer = allocate(size, alignment...);
+        if (pointer == nullptr) {
+            throw std::bad_alloc();
+        }
+        return pointer;
+    }
+} // Anonymous namespace
+
+// Replacements of the global allocation functions, counting every call
+void* operator new(std::size_t size) {
+    return allocateOrThrow(size);
+}
+
+void* operator new[](std::size_t size) {
+    return allocateOrThrow(size);
+}
+
+void* operator new(std::size_t size, const std::nothrow_t&) noexcept {
+    return allocate(size);
+}
+
+void* operator new[](std::size_t size, const std::nothrow_t&) noexcept {
+    return allocate(size);
+}
+
+void* operator new(std::size_t size, std::align_val_t alignment) {
+    return allocateOrThrow(size, alignment);
+}
+
+void* operator new[](std::size_t size, std::align_val_t alignment) {
+    return allocateOrThrow(size, alignment);
+}
+
+void* operator new(std::size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept {
+    return allocate(size, alignment);
+}
+
+void* operator new[](std::size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept {
+    return allocate(size, alignment);
+}
+
+void operator delete(void* pointer) noexcept {
+    std::free(pointer);
+}
+
+void operator delete[](void* pointer) noexcept {
+    std::free(pointer);
+}
+
+void operator delete(void* pointer, std::size_t) noexcept {
+    std::free(pointer);
+}
+
+void operator delete[](void* pointer, std::size_t) noexcept {
+    std::free(pointer);
+}
+
+void operator delete(void* pointer, const std::nothrow_t&) noexcept {
+    std::free(pointer);
+}
+
+void operator delete[](void* pointer, const std::nothrow_t&) noexcept {
+    std::free(pointer);
+}
+
+void operator delete(void* pointer, std::align_val_t alignment) noexcept {
+    deallocate(pointer, alignment);
+}
+
+void operator delete[](void* pointer, std::align_val_t alignment) noexcept {
+    deallocate(pointer, alignment);
+}
+
+void operator delete(void* pointer, std::size_t, std::align_val_t alignment) noexcept {
+    deallocate(pointer, alignment);
+}
+
+void operator delete[](void* pointer, std::size_t, std::align_val_t alignment) noexcept {
+    deallocate(pointer, alignment);
+}
+
+void operator delete(void* pointer, std::align_val_t alignment, const std::nothrow_t&) noexcept {
+    deallocate(pointer, alignment);
+}
+
+void operator delete[](void* pointer, std::align_val_t alignment, const std::nothrow_t&) noexcept {
+    deallocate(pointer, alignment);
+}
+#endif
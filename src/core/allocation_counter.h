@@ -0,0 +1,30 @@
+#pragma once
+
+#include <cassert>
+#include <cstddef>
+
+// Debug builds of the tools that link the allocation-counter library count
+// the heap allocations each thread makes through operator new, so code that
+// must never reach the allocator can assert it. Elsewhere the count is not
+// there and nothing is checked.
+#ifndef NDEBUG
+// allocations of the calling thread, set by allocation-counter when it is linked
+inline std::size_t (*allocation_count)() = nullptr;
+#endif
+
+// Asserts that the current thread does not allocate while it is alive
+class NoAllocationScope {
+    public:
+#ifndef NDEBUG
+    NoAllocationScope() : start(allocation_count ? allocation_count() : 0) {}
+    ~NoAllocationScope() {
+        assert((!allocation_count || allocation_count() == start) && "heap allocation inside an allocation-free scope");
+    }
+
+    private:
+    std::size_t start;
+#else
+    // user-provided, so release builds do not warn about an unused scope
+    NoAllocationScope() {}
+#endif
+};
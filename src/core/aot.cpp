@@ -0,0 +1,122 @@
+#include "aot.h"
+#include "chip8.h"
+
+#include <algorithm>
+
+#include <fmt/core.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <dlfcn.h>
+#endif
+
+const AotProgram* loadAotPlugin(const std::string& filename) {
+#ifdef _WIN32
+    HMODULE library = LoadLibraryA(filename.c_str());
+    if (library == nullptr) {
+        fmt::print("Could not load AOT plugin {}\n", filename);
+        return nullptr;
+    }
+    auto entry = reinterpret_cast<AotEntryFn>(GetProcAddress(library, POF_AOT_ENTRY_POINT));
+#else
+    void* library = dlopen(filename.c_str(), RTLD_NOW | RTLD_LOCAL);
+    if (library == nullptr) {
+        fmt::print("Could not load AOT plugin {}: {}\n", filename, dlerror());
+        return nullptr;
+    }
+    auto entry = reinterpret_cast<AotEntryFn>(dlsym(library, POF_AOT_ENTRY_POINT));
+#endif
+    if (entry == nullptr) {
+        fmt::print("{} is not an AOT plugin\n", filename);
+        return nullptr;
+    }
+    // the library stays loaded for the rest of the process
+    return entry();
+}
+
+AotRunner::AotRunner(const AotProgram& program, Chip8& chip) {
+    ctx.pc = &chip.pc;
+    ctx.I = &chip.I_reg;
+    ctx.V = chip.VX_reg;
+    ctx.delay_timer = &chip.delay_timer;
+    ctx.sound_timer = &chip.sound_timer;
+    ctx.chip = &chip;
+    ctx.execute = &AotRunner::executeHandler;
+
+    const auto program_start = chip.emulated_memory.begin() + 512;
+    if (program.rom_size > chip.emulated_memory.size() - 512
+        || !std::equal(program.rom, program.rom + program.rom_size, program_start)) {
+        fmt::print("AOT plugin was translated from a different program, interpreting instead\n");
+        return;
+    }
+
+    rom = program.rom;
+    rom_size = program.rom_size;
+    for (std::size_t i = 0; i < program.block_count; i++) {
+        const AotBlock& block = program.blocks[i];
+        if (block.address < entries.size()) {
+            translated[block.address] = &block;
+            entries[block.address] = &block;
+            max_block_bytes = std::max(max_block_bytes, block.end - block.address);
+        }
+    }
+}
+
+uint32_t AotRunner::run(Chip8& chip, uint32_t cycles) {
+    uint32_t remaining = cycles;
+    // blocks covering a breakpoint were invalidated when it was set
+    while(remaining > 0 && !chip.stop_requested) {
+        const AotBlock* block = chip.pc < entries.size() ? entries[chip.pc] : nullptr;
+        if(block == nullptr && chip.pc < unchecked.size() && unchecked[chip.pc]) {
+            block = recheck(chip, chip.pc);
+        }
+        if(block == nullptr) {
+            remaining -= chip.fetchDecodeExecute();
+            continue;
+        }
+        const uint32_t executed = block->run(ctx, remaining);
+        // a trap ends the block in the instruction that raised it, which did not retire
+        const bool trapped = !chip.is_running && chip.exit_reason != ExitReason::Shutdown;
+        remaining -= executed - trapped;
+    }
+    return cycles - remaining;
+}
+
+void AotRunner::invalidate(uint16_t address, uint16_t length) {
+    // modified code goes back to the interpreter until run checks it again
+    const int last = std::min<int>(address + length, translated.size());
+    for(int i = address; i < last; i++) {
+        const int first_start = std::max(i - max_block_bytes + 1, 0);
+        for(int start = first_start; start <= i; start++) {
+            if(translated[start] != nullptr && translated[start]->end > i) {
+                entries[start] = nullptr;
+                unchecked.set(start);
+            }
+        }
+    }
+}
+
+const AotBlock* AotRunner::recheck(const Chip8& chip, uint16_t address) {
+    // until another write or breakpoint touches it, the answer stays the same
+    unchecked.reset(address);
+    const AotBlock& block = *translated[address];
+    const auto memory = chip.emulated_memory.begin();
+    // a block reaching past the program was translated from bytes that are not in rom
+    if(block.address < 512 || block.end > 512 + rom_size
+       || !std::equal(memory + block.address, memory + block.end, rom + (block.address - 512))) {
+        return nullptr;
+    }
+    for(int i = block.address; i < block.end; i++) {
+        if(chip.breakpoints[i]) {
+            return nullptr;
+        }
+    }
+    entries[address] = &block;
+    return &block;
+}
+
+bool AotRunner::executeHandler(Chip8* chip, uint16_t opcode) {
+    chip->executeDecoded(decode(Instruction(opcode >> 8, opcode & 0xFF)));
+    return chip->stop_requested;
+}
@@ -0,0 +1,81 @@
+#pragma once
+
+#include <array>
+#include <bitset>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// Interface between the core and ROMs translated ahead of time by pof-aot.
+// Translated code only sees the structs below, so a plugin does not link
+// against the core.
+
+class Chip8;
+
+// Registers a translated block works on
+struct AotContext {
+    uint16_t* pc;
+    uint16_t* I;
+    uint8_t* V;
+    uint8_t* delay_timer;
+    uint8_t* sound_timer;
+
+    Chip8* chip;
+    // runs one instruction through the interpreter, pc must already point past it.
+    // Returns whether the block has to return, as the run is stopping.
+    bool (*execute)(Chip8* chip, uint16_t opcode);
+};
+
+// returns the instructions executed, at most budget
+using AotBlockFn = uint32_t (*)(AotContext& ctx, uint32_t budget);
+
+struct AotBlock {
+    uint16_t address;
+    uint16_t end; // one past the last byte translated
+    AotBlockFn run;
+};
+
+struct AotProgram {
+    const uint8_t* rom; // the program as loaded at 0x200
+    std::size_t rom_size;
+    const AotBlock* blocks;
+    std::size_t block_count;
+};
+
+#ifdef _WIN32
+#define POF_AOT_EXPORT extern "C" __declspec(dllexport)
+#else
+#define POF_AOT_EXPORT extern "C" __attribute__((visibility("default")))
+#endif
+
+// Every plugin exports this entry point
+#define POF_AOT_ENTRY_POINT "pofAotProgram"
+using AotEntryFn = const AotProgram* (*)();
+
+const AotProgram* loadAotPlugin(const std::string& filename);
+
+// Runs translated blocks where the program still matches memory and
+// interprets everywhere else. A block dropped for a write or a breakpoint
+// is checked again the next time the program enters it, and runs again once
+// its memory matches the translated bytes and no breakpoint is inside it.
+class AotRunner {
+    public:
+    AotRunner(const AotProgram& program, Chip8& chip);
+
+    // returns the instructions retired
+    uint32_t run(Chip8& chip, uint32_t cycles);
+    void invalidate(uint16_t address, uint16_t length);
+
+    private:
+    static bool executeHandler(Chip8* chip, uint16_t opcode);
+    // the block at address if it can run again, nullptr otherwise
+    const AotBlock* recheck(const Chip8& chip, uint16_t address);
+
+    const uint8_t* rom = nullptr;
+    std::size_t rom_size = 0;
+    std::array<const AotBlock*, 4096> translated{};
+    std::array<const AotBlock*, 4096> entries{}; // the translated blocks that may run
+    std::bitset<4096> unchecked; // dropped blocks touched since they were last checked
+    int max_block_bytes = 0;
+    AotContext ctx;
+};
@@ -0,0 +1,522 @@
+#include "batch.h"
+#include "allocation_counter.h"
+#include "font.h"
+
+#include <algorithm>
+#include <random>
+
+// The loop over every lane is also built for AVX2 and AVX-512, the loader
+// picks the widest the host supports. flatten pulls the handlers into each
+// clone, so they are vectorised for it too.
+#if defined(__x86_64__) && defined(__linux__) && defined(__has_attribute)
+#if __has_attribute(target_clones) && __has_attribute(flatten)
+#define CHIP8_BATCH_CLONES __attribute__((target_clones("avx512f", "avx2", "default"), flatten))
+#endif
+#endif
+#ifndef CHIP8_BATCH_CLONES
+#define CHIP8_BATCH_CLONES
+#endif
+
+namespace {
+    // Lanes a handler runs on: lane i is group[i] for i below count
+
+    // every lane, so the loops are dense and vectorise
+    struct AllLanes {
+        std::size_t count;
+
+        std::size_t operator[](std::size_t i) const {
+            return i;
+        }
+    };
+
+    // the lanes of one opcode
+    struct LaneList {
+        const uint32_t* lanes;
+        std::size_t count;
+
+        std::size_t operator[](std::size_t i) const {
+            return lanes[i];
+        }
+    };
+} // Anonymous namespace
+
+Chip8Batch::Chip8Batch(std::size_t lanes, Quirks quirks)
+    : lanes(lanes), quirks(quirks),
+      pc(lanes, 512), I_reg(lanes), delay_timer(lanes), sound_timer(lanes), keys(lanes), running(lanes, 1),
+      memory(lanes * memory_size), stack(lanes * stack_depth), stack_size(lanes), framebuffer(lanes * nHeight),
+      lane_group(lanes), group_of(1 << 16), group_opcode(lanes), group_start(lanes + 1), grouped_lanes(lanes) {
+    for(auto& registers : VX_reg) {
+        registers.resize(lanes);
+    }
+
+    randy.resize(lanes);
+    setSeed(std::random_device{}());
+    std::copy(font.begin(), font.end(), program_memory.begin() + font_starting_address);
+    for(std::size_t lane = 0; lane < lanes; lane++) {
+        std::copy(program_memory.begin(), program_memory.end(), laneMemory(lane));
+    }
+    for(std::size_t address = 0; address < memory_size; address++) {
+        decodeProgram(address);
+    }
+}
+
+void Chip8Batch::setSeed(uint32_t seed) {
+    for(std::size_t lane = 0; lane < lanes; lane++) {
+        randy[lane].seed(seed, lane);
+    }
+}
+
+void Chip8Batch::loadProgram(const std::vector<uint8_t>& program) {
+    const std::size_t length = std::min(program.size(), memory_size - 512);
+    std::copy_n(program.begin(), length, program_memory.begin() + 512);
+    for(std::size_t lane = 0; lane < lanes; lane++) {
+        std::copy_n(program.begin(), length, laneMemory(lane) + 512);
+    }
+    // every lane holds the program again, memory outside it may still differ
+    std::fill_n(written.begin() + 512, length, 0);
+    for(std::size_t address = 511; address < 512 + length; address++) {
+        decodeProgram(address);
+    }
+}
+
+std::size_t Chip8Batch::size() const {
+    return lanes;
+}
+
+void Chip8Batch::setKey(std::size_t lane, uint8_t n, bool state) {
+    if (n <= 0xF) {
+        keys[lane] = state ? keys[lane] | (1 << n) : keys[lane] & ~(1 << n);
+    }
+}
+
+bool Chip8Batch::isRunning(std::size_t lane) const {
+    return running[lane];
+}
+
+bool Chip8Batch::frameAt(std::size_t lane, uint8_t x, uint8_t y) const {
+    return (frameRow(lane, y) >> (nWidth - 1 - x)) & 1;
+}
+
+uint64_t Chip8Batch::frameRow(std::size_t lane, uint8_t y) const {
+    return framebuffer[lane * nHeight + y];
+}
+
+uint16_t Chip8Batch::pcAt(std::size_t lane) const {
+    return pc[lane];
+}
+
+uint16_t Chip8Batch::indexAt(std::size_t lane) const {
+    return I_reg[lane];
+}
+
+uint8_t Chip8Batch::registerAt(std::size_t lane, uint8_t x) const {
+    return VX_reg[x & 0xF][lane];
+}
+
+uint8_t Chip8Batch::delayTimerAt(std::size_t lane) const {
+    return delay_timer[lane];
+}
+
+uint8_t Chip8Batch::memoryAt(std::size_t lane, uint16_t address) const {
+    return laneMemory(lane)[address % memory_size];
+}
+
+Chip8State Chip8Batch::laneState(std::size_t lane) const {
+    Chip8State state;
+    state.pc = pc[lane];
+    state.I_reg = I_reg[lane];
+    for(std::size_t x = 0; x < VX_reg.size(); x++) {
+        state.VX_reg[x] = VX_reg[x][lane];
+    }
+    std::copy_n(laneMemory(lane), memory_size, state.emulated_memory.begin());
+    std::copy_n(&stack[lane * stack_depth], stack_depth, state.stack.begin());
+    state.stack_size = stack_size[lane];
+    state.delay_timer = delay_timer[lane];
+    state.sound_timer = sound_timer[lane];
+    for(uint8_t n = 0; n < 16; n++) {
+        state.key[n] = (keys[lane] >> n) & 1;
+    }
+    state.randy = randy[lane];
+    std::copy_n(&framebuffer[lane * nHeight], nHeight, state.framebuffer.begin());
+    return state;
+}
+
+uint8_t* Chip8Batch::laneMemory(std::size_t lane) {
+    return &memory[lane * memory_size];
+}
+
+const uint8_t* Chip8Batch::laneMemory(std::size_t lane) const {
+    return &memory[lane * memory_size];
+}
+
+inline uint8_t Chip8Batch::readMemory(std::size_t lane, uint16_t address) const {
+    address %= memory_size;
+    return written[address] ? laneMemory(lane)[address] : program_memory[address];
+}
+
+inline void Chip8Batch::writeMemory(std::size_t lane, uint16_t address, uint8_t value) {
+    address %= memory_size;
+    laneMemory(lane)[address] = value;
+    written[address] = 1;
+}
+
+void Chip8Batch::decodeProgram(std::size_t address) {
+    const Instruction instruction(program_memory[address], program_memory[(address + 1) % memory_size]);
+    program_opcode[address] = instruction.whole;
+    program_decoded[address] = decode(instruction);
+}
+
+void Chip8Batch::tickTimers() {
+    for(std::size_t lane = 0; lane < lanes; lane++) {
+        delay_timer[lane] -= delay_timer[lane] > 0;
+        sound_timer[lane] -= sound_timer[lane] > 0;
+    }
+}
+
+void Chip8Batch::tickCPU(uint32_t cycles) {
+    const NoAllocationScope no_allocations;
+    for(uint32_t i = 0; i < cycles; i++) {
+        step();
+    }
+}
+
+void Chip8Batch::step() {
+    const std::size_t count = lanes;
+    uint16_t* const lane_pc = pc.data();
+
+    // every lane at the same instruction, of code none has written
+    if(stopped == 0 && count > 0) {
+        const uint16_t first = lane_pc[0];
+        uint16_t differs = 0;
+        for(std::size_t lane = 0; lane < count; lane++) {
+            differs |= lane_pc[lane] ^ first;
+        }
+        if(differs == 0 && first < memory_size && !(written[first] | written[(first + 1) % memory_size])) {
+            executeAll(program_decoded[first]);
+            return;
+        }
+    }
+
+    // sort the running lanes into a list per opcode, in two passes
+    std::size_t groups = 0;
+    std::size_t grouped = 0;
+    for(std::size_t lane = 0; lane < count; lane++) {
+        if(!running[lane]) {
+            continue;
+        }
+        const uint16_t address = lane_pc[lane];
+        if(address >= memory_size) {
+            running[lane] = 0;
+            stopped++;
+            continue;
+        }
+        const uint16_t next = (address + 1) % memory_size;
+        const uint16_t lane_opcode = (written[address] | written[next])
+            ? laneMemory(lane)[address] << 8 | laneMemory(lane)[next] : program_opcode[address];
+        uint32_t& group = group_of[lane_opcode];
+        if(group == 0) {
+            group_opcode[groups] = lane_opcode;
+            group_start[groups] = 0;
+            group = static_cast<uint32_t>(++groups);
+        }
+        lane_group[lane] = group - 1;
+        group_start[group - 1]++;
+        grouped++;
+    }
+    // one opcode on every lane, though at different addresses
+    if(groups == 1 && grouped == count) {
+        group_of[group_opcode[0]] = 0;
+        executeAll(decode(Instruction(group_opcode[0] >> 8, group_opcode[0] & 0xFF)));
+        return;
+    }
+    // sizes to the end of each list, which the second pass fills from the back
+    for(std::size_t group = 1; group < groups; group++) {
+        group_start[group] += group_start[group - 1];
+    }
+    for(std::size_t lane = count; lane-- > 0;) {
+        if(running[lane]) {
+            grouped_lanes[--group_start[lane_group[lane]]] = static_cast<uint32_t>(lane);
+        }
+    }
+    group_start[groups] = static_cast<uint32_t>(grouped);
+    // one dense pass instead of one per list
+    const uint8_t* const lane_running = running.data();
+    for(std::size_t lane = 0; lane < count; lane++) {
+        lane_pc[lane] += lane_running[lane] << 1;
+    }
+
+    for(std::size_t group = 0; group < groups; group++) {
+        const uint16_t group_op = group_opcode[group];
+        group_of[group_op] = 0;
+        const uint32_t start = group_start[group];
+        execute(decode(Instruction(group_op >> 8, group_op & 0xFF)),
+                LaneList{&grouped_lanes[start], group_start[group + 1] - start});
+    }
+}
+
+CHIP8_BATCH_CLONES void Chip8Batch::executeAll(DecodedInstruction insty) {
+    uint16_t* const lane_pc = pc.data();
+    for(std::size_t lane = 0; lane < lanes; lane++) {
+        lane_pc[lane] += 2;
+    }
+    execute(insty, AllLanes{lanes});
+}
+
+template<typename Lanes>
+void Chip8Batch::execute(DecodedInstruction insty, Lanes group) {
+    uint8_t* const vx = VX_reg[insty.x].data();
+    const uint8_t* const vy = VX_reg[insty.y].data();
+    uint8_t* const vf = VX_reg[0xF].data();
+    uint16_t* const lane_pc = pc.data();
+    uint16_t* const lane_I = I_reg.data();
+    uint8_t* const delay = delay_timer.data();
+    uint8_t* const sound = sound_timer.data();
+    const uint8_t nn = insty.nn;
+    const uint16_t nnn = insty.nnn;
+    // a local bound, stores through the uint8_t pointers could alias the member
+    const std::size_t count = group.count;
+
+    // applies f to every lane of the group
+    const auto forEachLane = [&](auto f) {
+        for(std::size_t i = 0; i < count; i++) {
+            f(group[i]);
+        }
+    };
+    // advances pc past the next instruction where condition holds
+    const auto skipIf = [&](auto condition) {
+        forEachLane([&](std::size_t lane) {
+            lane_pc[lane] += condition(lane) << 1;
+        });
+    };
+
+    switch(insty.op) {
+        case Op::ClearScreen: // 00E0 clear screen
+            forEachLane([&](std::size_t lane) {
+                std::fill_n(framebuffer.begin() + lane * nHeight, nHeight, 0);
+            });
+            break;
+        case Op::Return: // 00EE return from subroutine
+            forEachLane([&](std::size_t lane) {
+                if(stack_size[lane] == 0) {
+                    lane_pc[lane] -= 2;
+                    running[lane] = 0;
+                    stopped++;
+                    return;
+                }
+                lane_pc[lane] = stack[lane * stack_depth + --stack_size[lane]];
+            });
+            break;
+        case Op::Jump: // 1NNN jump
+            forEachLane([&](std::size_t lane) {
+                lane_pc[lane] = nnn;
+            });
+            break;
+        case Op::Call: // 2NNN call subroutine
+            forEachLane([&](std::size_t lane) {
+                if(stack_size[lane] == stack_depth) {
+                    lane_pc[lane] -= 2;
+                    running[lane] = 0;
+                    stopped++;
+                    return;
+                }
+                stack[lane * stack_depth + stack_size[lane]++] = lane_pc[lane];
+                lane_pc[lane] = nnn;
+            });
+            break;
+        case Op::SkipEqualImm: // 3XNN skip equal
+            skipIf([&](std::size_t lane) { return vx[lane] == nn; });
+            break;
+        case Op::SkipNotEqualImm: // 4XNN skip not equal
+            skipIf([&](std::size_t lane) { return vx[lane] != nn; });
+            break;
+        case Op::SkipEqualReg: // 5XY0 skip if Vx == Vy
+            skipIf([&](std::size_t lane) { return vx[lane] == vy[lane]; });
+            break;
+        case Op::SkipNotEqualReg: // 9XY0 skip if Vx != Vy
+            skipIf([&](std::size_t lane) { return vx[lane] != vy[lane]; });
+            break;
+        case Op::SetImm: // 6XNN set register VX
+            forEachLane([&](std::size_t lane) {
+                vx[lane] = nn;
+            });
+            break;
+        case Op::AddImm: // 7XNN add value to register VX
+            forEachLane([&](std::size_t lane) {
+                vx[lane] += nn;
+            });
+            break;
+        case Op::SetReg: // 8XY0 set
+            forEachLane([&](std::size_t lane) {
+                vx[lane] = vy[lane];
+            });
+            break;
+        case Op::Or: // 8XY1 bitwise logical OR
+            forEachLane([&](std::size_t lane) {
+                vx[lane] |= vy[lane];
+            });
+            break;
+        case Op::And: // 8XY2 bitwise logical AND
+            forEachLane([&](std::size_t lane) {
+                vx[lane] &= vy[lane];
+            });
+            break;
+        case Op::Xor: // 8XY3 bitwise logical XOR
+            forEachLane([&](std::size_t lane) {
+                vx[lane] ^= vy[lane];
+            });
+            break;
+        case Op::AddReg: // 8XY4 add
+            // the flag is written first so that 8FY4 keeps the sum, as in Chip8
+            forEachLane([&](std::size_t lane) {
+                const uint16_t sum = vx[lane] + vy[lane];
+                vf[lane] = sum > 255;
+                vx[lane] = sum & 0xFF;
+            });
+            break;
+        case Op::SubReg: // 8XY5 subtract
+            forEachLane([&](std::size_t lane) {
+                const uint8_t x = vx[lane];
+                const uint8_t y = vy[lane];
+                vx[lane] = x - y;
+                vf[lane] = x >= y;
+            });
+            break;
+        case Op::SubnReg: // 8XY7 subtract
+            forEachLane([&](std::size_t lane) {
+                const uint8_t x = vx[lane];
+                const uint8_t y = vy[lane];
+                vx[lane] = y - x;
+                vf[lane] = y >= x;
+            });
+            break;
+        case Op::ShiftRight: // 8XY6 right shift
+            // in the order of Chip8, so that with X = F the shift reads the flag
+            forEachLane([&](std::size_t lane) {
+                if(!(quirks & quirk_new_shift)) {
+                    vx[lane] = vy[lane];
+                }
+                vf[lane] = vx[lane] & 1;
+                vx[lane] = vx[lane] >> 1;
+            });
+            break;
+        case Op::ShiftLeft: // 8XYE left shift
+            forEachLane([&](std::size_t lane) {
+                if(!(quirks & quirk_new_shift)) {
+                    vx[lane] = vy[lane];
+                }
+                vf[lane] = vx[lane] >> 7;
+                vx[lane] = vx[lane] << 1;
+            });
+            break;
+        case Op::SetIndex: // ANNN set index register I
+            forEachLane([&](std::size_t lane) {
+                lane_I[lane] = nnn;
+            });
+            break;
+        case Op::JumpOffset: // BNNN jump with offset
+        {
+            const uint8_t* const offset = VX_reg[(quirks & quirk_quirky_jump) ? insty.x : 0].data();
+            forEachLane([&](std::size_t lane) {
+                lane_pc[lane] = nnn + offset[lane];
+            });
+            break;
+        }
+        case Op::Random: // CXNN random
+            forEachLane([&](std::size_t lane) {
+                vx[lane] = randy[lane]() & nn;
+            });
+            break;
+        case Op::Draw: // DXYN display/draw
+        {
+            const unsigned height = insty.n;
+            forEachLane([&](std::size_t lane) {
+                const unsigned x = vx[lane] % nWidth;
+                const unsigned y = vy[lane] % nHeight;
+                uint64_t* rows = &framebuffer[lane * nHeight];
+                uint64_t unset = 0;
+                for(unsigned i = 0; i < height && y + i < nHeight; i++) {
+                    const uint64_t sprite = static_cast<uint64_t>(readMemory(lane, lane_I[lane] + i)) << 56 >> x;
+                    unset |= rows[y + i] & sprite;
+                    rows[y + i] ^= sprite;
+                }
+                vf[lane] = unset != 0;
+            });
+            break;
+        }
+        case Op::SkipKey: // EX9E skip if key pressed
+            skipIf([&](std::size_t lane) { return (vx[lane] < 16) & ((keys[lane] >> (vx[lane] & 0xF)) & 1); });
+            break;
+        case Op::SkipNotKey: // EXA1 skip if key not pressed
+            skipIf([&](std::size_t lane) { return !((vx[lane] < 16) & ((keys[lane] >> (vx[lane] & 0xF)) & 1)); });
+            break;
+        case Op::GetDelay: // FX07 get delay timer
+            forEachLane([&](std::size_t lane) {
+                vx[lane] = delay[lane];
+            });
+            break;
+        case Op::WaitKey: // FX0A get key
+            forEachLane([&](std::size_t lane) {
+                if(keys[lane] == 0) {
+                    lane_pc[lane] -= 2;
+                    return;
+                }
+                uint8_t pressed = 0;
+                while(!((keys[lane] >> pressed) & 1)) {
+                    pressed++;
+                }
+                vx[lane] = pressed;
+            });
+            break;
+        case Op::SetDelay: // FX15 set delay timer
+            forEachLane([&](std::size_t lane) {
+                delay[lane] = vx[lane];
+            });
+            break;
+        case Op::SetSound: // FX18 set sound timer
+            forEachLane([&](std::size_t lane) {
+                sound[lane] = vx[lane];
+            });
+            break;
+        case Op::AddIndex: // FX1E add to index
+            forEachLane([&](std::size_t lane) {
+                lane_I[lane] += vx[lane];
+            });
+            break;
+        case Op::FontChar: // FX29 font character
+            forEachLane([&](std::size_t lane) {
+                lane_I[lane] = font_starting_address + 5*(vx[lane] & 0xF);
+            });
+            break;
+        case Op::Bcd: // FX33 decimal conversion
+            forEachLane([&](std::size_t lane) {
+                const uint8_t number = vx[lane];
+                writeMemory(lane, lane_I[lane], number / 100);
+                writeMemory(lane, lane_I[lane] + 1, (number % 100) / 10);
+                writeMemory(lane, lane_I[lane] + 2, number % 10);
+            });
+            break;
+        case Op::Store: // FX55 store in memory
+            forEachLane([&](std::size_t lane) {
+                for(int i = 0; i <= insty.x; i++) {
+                    writeMemory(lane, lane_I[lane] + i, VX_reg[i][lane]);
+                }
+                if(quirks & quirk_load_store) {
+                    lane_I[lane] += insty.x;
+                }
+            });
+            break;
+        case Op::Load: // FX65 load from memory
+            forEachLane([&](std::size_t lane) {
+                for(int i = 0; i <= insty.x; i++) {
+                    VX_reg[i][lane] = readMemory(lane, lane_I[lane] + i);
+                }
+                if(quirks & quirk_load_store) {
+                    lane_I[lane] += insty.x;
+                }
+            });
+            break;
+        default:
+            // unhandled, and superinstructions which decode never produces
+            break;
+    }
+}
@@ -0,0 +1,109 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "chip8.h"
+#include "decoder.h"
+#include "random.h"
+
+// Steps many machines running the same program in lockstep, for workloads
+// such as training that run one ROM in thousands of environments.
+//
+// State is stored as structure of arrays: each register is one array with
+// an element per machine (lane). When every lane is at the same
+// instruction, which is the common case, a step runs it in one dense loop
+// over those arrays, built for AVX2 and AVX-512 too where the compiler
+// supports it. Otherwise the lanes are sorted into a list per opcode and
+// each handler runs once over its own list, so a step stays linear in the
+// lanes however far they split up.
+//
+// Every lane has its own memory, but code and sprites that no lane has
+// written are read from the loaded program, which is decoded once and
+// stays in cache.
+//
+// Semantics follow Chip8::execute, with a lane stopping where Chip8 traps
+// on a stack over- or underflow or a pc outside memory, except that
+// unhandled opcodes are skipped silently.
+class Chip8Batch {
+    public:
+    explicit Chip8Batch(std::size_t lanes, Quirks quirks = default_quirks);
+
+    // loads the same program at 0x200 in every lane
+    void loadProgram(const std::vector<uint8_t>& program);
+
+    std::size_t size() const;
+
+    void tickCPU(uint32_t cycles);
+    void tickTimers();
+
+    void setKey(std::size_t lane, uint8_t n, bool state);
+    // every lane draws its own sequence, the same on every run with the same
+    // seed. Lane n draws what a Chip8 seeded with Pcg32(seed, n) would.
+    void setSeed(uint32_t seed);
+
+    bool isRunning(std::size_t lane) const;
+    bool frameAt(std::size_t lane, uint8_t x, uint8_t y) const;
+    // bit 63 is x = 0
+    uint64_t frameRow(std::size_t lane, uint8_t y) const;
+
+    uint16_t pcAt(std::size_t lane) const;
+    uint16_t indexAt(std::size_t lane) const;
+    uint8_t registerAt(std::size_t lane, uint8_t x) const;
+    uint8_t delayTimerAt(std::size_t lane) const;
+    uint8_t memoryAt(std::size_t lane, uint16_t address) const;
+    // the whole machine of a lane, to compare with a Chip8. The clock is left at zero.
+    Chip8State laneState(std::size_t lane) const;
+
+    private:
+    static constexpr std::size_t memory_size = 4096;
+    static constexpr std::size_t stack_depth = 16;
+
+    void step();
+    // every lane runs insty
+    void executeAll(DecodedInstruction insty);
+    // the lanes picked by group run insty, their pc already past it
+    template<typename Lanes>
+    void execute(DecodedInstruction insty, Lanes group);
+
+    uint8_t* laneMemory(std::size_t lane);
+    const uint8_t* laneMemory(std::size_t lane) const;
+    // a byte of a lane's memory, from the loaded program where no lane wrote it
+    uint8_t readMemory(std::size_t lane, uint16_t address) const;
+    void writeMemory(std::size_t lane, uint16_t address, uint8_t value);
+    // refreshes the loaded program at address
+    void decodeProgram(std::size_t address);
+
+    std::size_t lanes;
+    Quirks quirks;
+
+    std::vector<uint16_t> pc;
+    std::vector<uint16_t> I_reg;
+    std::array<std::vector<uint8_t>, 16> VX_reg;
+    std::vector<uint8_t> delay_timer;
+    std::vector<uint8_t> sound_timer;
+    std::vector<uint16_t> keys; // bit n is key n
+    std::vector<uint8_t> running;
+    std::size_t stopped = 0; // lanes no longer running
+
+    std::vector<uint8_t> memory; // memory_size bytes per lane
+    std::vector<uint16_t> stack; // stack_depth entries per lane
+    std::vector<uint8_t> stack_size;
+    std::vector<uint64_t> framebuffer; // nHeight rows per lane
+    std::vector<Pcg32> randy; // one stream per lane
+
+    // memory as loaded, which every lane still holds where written is clear
+    std::array<uint8_t, memory_size> program_memory{};
+    std::array<uint16_t, memory_size> program_opcode{};
+    std::array<DecodedInstruction, memory_size> program_decoded{};
+    std::array<uint8_t, memory_size> written{}; // 1 where some lane has written
+
+    // per step scratch for lanes that disagree
+    std::vector<uint32_t> lane_group; // per lane
+    std::vector<uint32_t> group_of; // per opcode, 1 + its group this step or 0
+    std::vector<uint16_t> group_opcode; // per group
+    std::vector<uint32_t> group_start; // per group, into grouped_lanes
+    std::vector<uint32_t> grouped_lanes; // lanes in the order of their groups
+};
@@ -1,99 +1,67 @@
 #include "chip8.h"
+#include "allocation_counter.h"
+#include "aot.h"
+#include "font.h"
+#include "movie.h"
+#include "pacer.h"
+#include "rewind.h"
 #include <algorithm>
-#include <chrono>
+#include <cstring>
+#include <iterator>
 #include <random>
-#include <thread>
 
 #include <fmt/core.h>
 
-#define CHIP8_NEW_SHIFT
-
-Chip8 global_chip;
-
-namespace {
-    auto seed = std::chrono::system_clock::now().time_since_epoch().count();
-    std::default_random_engine randy(seed);
-
-    auto timer_previous_time = std::chrono::system_clock::now().time_since_epoch();
-    auto main_previous_time = std::chrono::system_clock::now().time_since_epoch();
-
-    constexpr std::array<uint8_t, 80> font = {
-    0xF0, 0x90, 0x90, 0x90, 0xF0, // 0
-    0x20, 0x60, 0x20, 0x20, 0x70, // 1
-    0xF0, 0x10, 0xF0, 0x80, 0xF0, // 2
-    0xF0, 0x10, 0xF0, 0x10, 0xF0, // 3
-    0x90, 0x90, 0xF0, 0x10, 0x10, // 4
-    0xF0, 0x80, 0xF0, 0x10, 0xF0, // 5
-    0xF0, 0x80, 0xF0, 0x90, 0xF0, // 6
-    0xF0, 0x10, 0x20, 0x40, 0x40, // 7
-    0xF0, 0x90, 0xF0, 0x90, 0xF0, // 8
-    0xF0, 0x90, 0xF0, 0x10, 0xF0, // 9
-    0xF0, 0x90, 0xF0, 0x90, 0x90, // A
-    0xE0, 0x90, 0xE0, 0x90, 0xE0, // B
-    0xF0, 0x80, 0x80, 0x80, 0xF0, // C
-    0xE0, 0x90, 0x90, 0x90, 0xE0, // D
-    0xF0, 0x80, 0xF0, 0x80, 0xF0, // E
-    0xF0, 0x80, 0xF0, 0x80, 0x80  // F
-    };
-
-    constexpr uint16_t font_starting_address = 0x50;
-
-} // Anonymous namespace
+// Every Quirks mask, the core is instantiated once for each
+#define CHIP8_QUIRK_MASKS(X) X(0) X(1) X(2) X(3) X(4) X(5) X(6) X(7)
 
-struct Instruction {
-    uint16_t whole{0};
-
-    constexpr Instruction(uint8_t a, uint8_t b) {
-        whole = static_cast<uint16_t>(a) << 8 | b;
-    }
-
-    template<int N>
-    constexpr uint8_t getNibble() const {
-        return (whole >> (4*N)) & 0xF;
-    }
-
-    constexpr uint8_t getFirstNibble() const {
-        return getNibble<3>();
-    }
-    constexpr uint8_t getSecondNibble() const {
-        return getNibble<2>();
+std::optional<Quirks> quirksFromName(std::string_view name) {
+    if(name == "modern") {
+        return default_quirks;
     }
-    constexpr uint8_t getThirdNibble() const {
-        return getNibble<1>();
+    if(name == "cosmac") {
+        return quirk_load_store;
     }
-    constexpr uint8_t getFourthNibble() const {
-        return getNibble<0>();
-    }
-
-    constexpr uint16_t getLastThreeNibbles() const {
-        return whole & 0xFFF;
+    if(name == "schip") {
+        return quirk_new_shift | quirk_quirky_jump;
     }
+    return std::nullopt;
+}
 
-    template<int N>
-    constexpr uint8_t getByte() const {
-        return (whole >> (8*N)) & 0xFF;
+std::optional<CpuBackend> cpuBackendFromName(std::string_view name) {
+    if(name == "switch") {
+        return CpuBackend::Switch;
     }
-
-    constexpr uint8_t getFirstByte() const {
-        return getByte<1>();
+    if(name == "threaded") {
+        return CpuBackend::Threaded;
     }
-    constexpr uint8_t getSecondByte() const {
-        return getByte<0>();
+    if(name == "jit") {
+        return CpuBackend::Jit;
     }
+    return std::nullopt;
+}
 
-};
-
-void printUnhandledOpcode(Instruction opcode) {
-    fmt::print("Unhandled opcode {:#06x}\n", opcode.whole);
+void printUnhandledOpcode(uint16_t opcode) {
+    fmt::print("Unhandled opcode {:#06x}\n", opcode);
 }
 
 Chip8::Chip8() {
+    randy.seed(std::random_device{}());
+
     // Font
     auto font_address = emulated_memory.begin() + font_starting_address;
 
     std::copy(font.begin(), font.end(), font_address);
 }
 
+Chip8::~Chip8() = default;
+
+void Chip8::loadProgram(const std::vector<uint8_t>& program) {
+    const std::size_t length = std::min<std::size_t>(program.size(), emulated_memory.size() - 512);
+    std::copy_n(program.begin(), length, emulated_memory.begin() + 512);
+    invalidateDecoded(512, length);
+}
+
 void Chip8::beep() {
     fmt::print("beep\n");
 }
@@ -101,15 +69,142 @@ void Chip8::beep() {
 void Chip8::setKey(uint8_t n, bool state) {
     if (n <= 0xF) {
         key[n] = state;
+        if (recording) {
+            recording->events.push_back({clock.cycles(), n, state});
+        }
+    }
+    wakeUp();
+}
+
+void Chip8::queueKey(uint8_t n, bool state) {
+    {
+        std::lock_guard<std::mutex> lock(input_mutex);
+        queued_keys.emplace_back(n, state);
+    }
+    wakeUp();
+}
+
+void Chip8::startRecording(Movie& movie) {
+    recording = &movie;
+}
+
+void Chip8::stopRecording() {
+    recording = nullptr;
+}
+
+void Chip8::play(const Movie& movie) {
+    movie_player = std::make_unique<MoviePlayer>(movie);
+}
+
+void Chip8::enableRewind(std::size_t budget_bytes) {
+    rewind_buffer = budget_bytes > 0 ? std::make_unique<RewindBuffer>(budget_bytes) : nullptr;
+}
+
+void Chip8::setRewinding(bool rewinding) {
+    this->rewinding = rewinding;
+    wakeUp();
+}
+
+// Applies the input due at the start of a tick of mainLoop
+void Chip8::applyInput() {
+    if (movie_player) {
+        movie_player->apply(*this);
+        return;
+    }
+    std::lock_guard<std::mutex> lock(input_mutex);
+    uint16_t changed = 0; // a second change of a key waits for the next tick
+    std::size_t applied = 0;
+    for (; applied < queued_keys.size(); applied++) {
+        const auto [n, state] = queued_keys[applied];
+        if (changed & (1 << (n & 0xF))) {
+            break;
+        }
+        changed |= 1 << (n & 0xF);
+        setKey(n, state);
+    }
+    queued_keys.erase(queued_keys.begin(), queued_keys.begin() + applied);
+}
+
+void Chip8::wakeUp() {
+    {
+        std::lock_guard<std::mutex> lock(halt_mutex);
+        wakeup_pending = true;
     }
+    halt_wakeup.notify_all();
 }
 
 void Chip8::setCoreFrequency(int f) {
-    micro_wait = 1000000 / f;
+    clock.setFrequency(std::max(f, 1));
 }
 
 bool Chip8::frameAt(uint8_t x, uint8_t y) const {
-    return framebuffer[y*nWidth + x];
+    return (framebuffer[y] >> (nWidth - 1 - x)) & 1;
+}
+
+uint64_t Chip8::frameRow(uint8_t y) const {
+    return framebuffer[y];
+}
+
+uint64_t frameHash(const Chip8State& state) {
+    uint64_t hash = 0xCBF29CE484222325u;
+    for(const uint64_t row : state.framebuffer) {
+        for(int byte = 0; byte < 8; byte++) {
+            hash = (hash ^ ((row >> (8*byte)) & 0xFF)) * 0x100000001B3u;
+        }
+    }
+    return hash;
+}
+
+uint64_t Chip8::frameHash() const {
+    return ::frameHash(*this);
+}
+
+uint64_t Chip8::cycles() const {
+    return clock.cycles();
+}
+
+Chip8State Chip8::snapshot() const {
+    return *this;
+}
+
+void Chip8::restore(const Chip8State& state) {
+    restoreState(state);
+    // a machine that stopped on an error runs again from the restored state
+    is_running = true;
+    exit_reason = ExitReason::None;
+    stop_requested = false;
+    is_idle = false;
+    is_halted = false;
+}
+
+void Chip8::restoreState(const Chip8State& state) {
+    // only code in chunks that differ needs decoding or translating again
+    constexpr std::size_t chunk = 64;
+    for(std::size_t start = 0; start < emulated_memory.size(); start += chunk) {
+        if(std::memcmp(&emulated_memory[start], &state.emulated_memory[start], chunk) != 0) {
+            invalidateDecoded(start, chunk);
+        }
+    }
+
+    frame_mutex.lock();
+    static_cast<Chip8State&>(*this) = state;
+    frame_mutex.unlock();
+    frame_dirty = true;
+}
+
+void Chip8::setBreakpoint(uint16_t address) {
+    if(address < breakpoints.size()) {
+        breakpoints.set(address);
+        // cached code must not run through the new breakpoint
+        invalidateDecoded(address, 2);
+    }
+}
+
+void Chip8::clearBreakpoint(uint16_t address) {
+    if(address < breakpoints.size()) {
+        breakpoints.reset(address);
+        invalidateDecoded(address, 2);
+    }
 }
 
 bool Chip8::isFrameDirty() const {
@@ -124,8 +219,69 @@ bool Chip8::isRunning() const {
     return is_running;
 }
 
+// Stops the machine on an error in the program
+void Chip8::trap(ExitReason reason, std::string_view message) {
+    fmt::print("{}\n", message);
+    is_running = false;
+    exit_reason = reason;
+    stop_requested = true;
+    stop_reason = StopReason::Stopped;
+}
+
+// Ends the current run after this instruction if its caller asked to stop for reason
+inline void Chip8::requestStop(StopReason reason) {
+    if(stop_mask & stopBit(reason)) {
+        stop_reason = reason;
+        stop_requested = true;
+    }
+}
+
+bool Chip8::isIdle() const {
+    return is_idle;
+}
+
+bool Chip8::isHalted() const {
+    return is_halted;
+}
+
+ExitReason Chip8::exitReason() const {
+    return exit_reason;
+}
+
 void Chip8::shutDown() {
     is_running = false;
+    if(exit_reason == ExitReason::None) {
+        exit_reason = ExitReason::Shutdown;
+    }
+    wakeUp();
+}
+
+// I can point anywhere in 64 KiB, memory accesses through it wrap at 4 KiB
+void Chip8::writeMemory(uint16_t address, uint8_t value) {
+    address %= emulated_memory.size();
+    emulated_memory[address] = value;
+    invalidateDecoded(address, 1);
+}
+
+void Chip8::invalidateDecoded(uint16_t address, uint16_t length) {
+    // instructions starting up to one byte earlier, and superinstructions
+    // starting up to a whole sequence earlier, also cover the first address
+    const int first = std::max<int>(address - (2*max_fused_length - 1), 0);
+    const int last = std::min<int>(address + length, decoded.size());
+    for(int i = first; i < last; i++) {
+        decoded[i].op = Op::Undecoded;
+        decoded[i].base = Op::Undecoded;
+    }
+    if(jit) {
+        jit->invalidate(address, length);
+    }
+    if(aot) {
+        aot->invalidate(address, length);
+    }
+    // the instruction at 4095 takes its low byte from address 0
+    if(address == 0 && length > 0) {
+        invalidateDecoded(decoded.size() - 1, 1);
+    }
 }
 
 void Chip8::tickDelayTimer() {
@@ -141,284 +297,594 @@ void Chip8::tickSoundTimer() {
     }
 }
 
-void Chip8::tickCPU(uint32_t cycles) {
-    for(uint32_t i = 0; i < cycles; i++){
-        fetchDecodeExecute();
+template<Quirks quirks, Op op>
+inline uint32_t Chip8::execute(DecodedInstruction insty) {
+    if constexpr (op == Op::ClearScreen) { // 00E0 clear screen
+        framebuffer.fill(0);
+        frame_dirty = true;
+        requestStop(StopReason::FrameDrawn);
+    }
+    else if constexpr (op == Op::Return) { // 00EE return from subroutine
+        if(stack_size == 0) {
+            pc -= 2;
+            trap(ExitReason::StackUnderflow, "Stack underflow");
+            return 0;
+        }
+        else {
+            stack_size--;
+            pc = stack[stack_size];
+        }
+    }
+    else if constexpr (op == Op::Jump) { // 1NNN jump
+        if(insty.nnn == pc - 2) {
+            requestStop(StopReason::Halt);
+        }
+        pc = insty.nnn;
+    }
+    else if constexpr (op == Op::Call) { // 2NNN call subroutine
+        if(stack_size == stack.size()) {
+            pc -= 2;
+            trap(ExitReason::StackOverflow, "Stack overflow");
+            return 0;
+        }
+        else {
+            stack[stack_size] = pc;
+            stack_size++;
+            pc = insty.nnn;
+        }
+    }
+    else if constexpr (op == Op::SkipEqualImm) { // 3XNN skip equal
+        if(VX_reg[insty.x] == insty.nn) {
+            pc += 2;
+        }
+    }
+    else if constexpr (op == Op::SkipNotEqualImm) { // 4XNN skip not equal
+        if(VX_reg[insty.x] != insty.nn) {
+            pc += 2;
+        }
+    }
+    else if constexpr (op == Op::SkipEqualReg) { // 5XY0 skip if Vx == Vy
+        if(VX_reg[insty.x] == VX_reg[insty.y]) {
+            pc += 2;
+        }
+    }
+    else if constexpr (op == Op::SkipNotEqualReg) { // 9XY0 skip if Vx != Vy
+        if(VX_reg[insty.x] != VX_reg[insty.y]) {
+            pc += 2;
+        }
+    }
+    else if constexpr (op == Op::SetImm) { // 6XNN set register VX
+        VX_reg[insty.x] = insty.nn;
+    }
+    else if constexpr (op == Op::AddImm) { // 7XNN add value to register VX
+        VX_reg[insty.x] += insty.nn;
+    }
+    else if constexpr (op == Op::SetReg) { // 8XY0 set
+        VX_reg[insty.x] = VX_reg[insty.y];
+    }
+    else if constexpr (op == Op::Or) { // 8XY1 bitwise logical OR
+        VX_reg[insty.x] = VX_reg[insty.x] | VX_reg[insty.y];
+    }
+    else if constexpr (op == Op::And) { // 8XY2 bitwise logical AND
+        VX_reg[insty.x] = VX_reg[insty.x] & VX_reg[insty.y];
+    }
+    else if constexpr (op == Op::Xor) { // 8XY3 bitwise logical XOR
+        VX_reg[insty.x] = VX_reg[insty.x] ^ VX_reg[insty.y];
+    }
+    else if constexpr (op == Op::AddReg) { // 8XY4 add
+        const uint16_t sum = static_cast<uint16_t>(VX_reg[insty.x]) + VX_reg[insty.y];
+        VX_reg[0xF] = (sum > 255);
+        VX_reg[insty.x] = static_cast<uint8_t>(sum % 256);
+    }
+    else if constexpr (op == Op::SubReg) { // 8XY5 subtract
+        const uint8_t vx = VX_reg[insty.x];
+        const uint8_t vy = VX_reg[insty.y];
+        VX_reg[insty.x] = vx - vy;
+        VX_reg[0xF] = (vx >= vy);
+    }
+    else if constexpr (op == Op::SubnReg) { // 8XY7 subtract
+        const uint8_t vx = VX_reg[insty.x];
+        const uint8_t vy = VX_reg[insty.y];
+        VX_reg[insty.x] = vy - vx;
+        VX_reg[0xF] = (vy >= vx);
+    }
+    else if constexpr (op == Op::ShiftRight) { //8XY6 right shift
+        if constexpr (!(quirks & quirk_new_shift)) {
+            VX_reg[insty.x] = VX_reg[insty.y];
+        }
+        VX_reg[0xF] = VX_reg[insty.x] & 1;
+        VX_reg[insty.x] = VX_reg[insty.x] >> 1;
+    }
+    else if constexpr (op == Op::ShiftLeft) { //8XYE left shift
+        if constexpr (!(quirks & quirk_new_shift)) {
+            VX_reg[insty.x] = VX_reg[insty.y];
+        }
+        VX_reg[0xF] = (VX_reg[insty.x] & 0x80) >> 7;
+        VX_reg[insty.x] = VX_reg[insty.x] << 1;
+    }
+    else if constexpr (op == Op::SetIndex) { // ANNN set index register I
+        I_reg = insty.nnn;
+    }
+    else if constexpr (op == Op::JumpOffset) { // BNNN jump with offset
+        if constexpr (quirks & quirk_quirky_jump) {
+            pc = insty.nnn + VX_reg[insty.x];
+        }
+        else {
+            pc = insty.nnn + VX_reg[0];
+        }
+    }
+    else if constexpr (op == Op::Random) { // CXNN random
+        VX_reg[insty.x] = randy() & insty.nn;
+    }
+    else if constexpr (op == Op::Draw) { // DXYN display/draw
+        const unsigned x = VX_reg[insty.x] % nWidth;
+        const unsigned y = VX_reg[insty.y] % nHeight;
+        uint64_t unset = 0;
+
+        frame_mutex.lock();
+        for(unsigned i = 0; i < insty.n && y + i < nHeight; i++) {
+            // the sprite row moved to column x, clipped at the right edge
+            const uint64_t sprite = static_cast<uint64_t>(emulated_memory[(I_reg+i) % emulated_memory.size()]) << 56 >> x;
+            unset |= framebuffer[y + i] & sprite;
+            framebuffer[y + i] ^= sprite;
+        }
+        frame_mutex.unlock();
+        VX_reg[0xF] = unset != 0;
+
+        frame_dirty = true;
+        requestStop(StopReason::FrameDrawn);
+    }
+    else if constexpr (op == Op::SkipKey) { // EX9E skip if key pressed
+        if(VX_reg[insty.x] < 16 && key[VX_reg[insty.x]]) {
+            pc += 2;
+        }
+    }
+    else if constexpr (op == Op::SkipNotKey) { // EXA1 skip if key not pressed
+        if(VX_reg[insty.x] >= 16 || !key[VX_reg[insty.x]]) {
+            pc += 2;
+        }
+    }
+    else if constexpr (op == Op::GetDelay) { // FX07 get delay timer
+        VX_reg[insty.x] = delay_timer;
+    }
+    else if constexpr (op == Op::SetDelay) { // FX15 set delay timer
+        delay_timer = VX_reg[insty.x];
     }
+    else if constexpr (op == Op::SetSound) { // FX18 set sound timer
+        if(sound_timer == 0 && VX_reg[insty.x] != 0) {
+            requestStop(StopReason::SoundStart);
+        }
+        sound_timer = VX_reg[insty.x];
+    }
+    else if constexpr (op == Op::WaitKey) { // FX0A get key
+        bool pressed = false;
+        for (int i=0; i<16; i++) {
+            if(key[i]){
+                pressed = true;
+                VX_reg[insty.x] = i;
+                break;
+            }
+        }
+        if(!pressed) {
+            pc-=2;
+            requestStop(StopReason::KeyWait);
+        }
+    }
+    else if constexpr (op == Op::AddIndex) { // FX1E add to index
+        I_reg += VX_reg[insty.x];
+    }
+    else if constexpr (op == Op::FontChar) { // FX29 font character
+        const uint8_t x = VX_reg[insty.x];
+        I_reg = font_starting_address + 5*(x & 0xF);
+    }
+    else if constexpr (op == Op::Bcd) { // FX33 decimal conversion
+        const uint8_t number = VX_reg[insty.x];
+        writeMemory(I_reg, number / 100);
+        writeMemory(I_reg+1, (number % 100) / 10);
+        writeMemory(I_reg+2, number % 10);
+    }
+    else if constexpr (op == Op::Store) { // FX55 store in memory
+        const uint8_t x = insty.x;
+        for(int i=0; i<=x; i++) {
+            writeMemory(I_reg+i, VX_reg[i]);
+        }
+        if constexpr (quirks & quirk_load_store) {
+            I_reg += x;
+        }
+    }
+    else if constexpr (op == Op::Load) { // FX65 load from memory
+        const uint8_t x = insty.x;
+        for(int i=0; i<=x; i++) {
+            VX_reg[i] = emulated_memory[(I_reg+i) % emulated_memory.size()];
+        }
+        if constexpr (quirks & quirk_load_store) {
+            I_reg += x;
+        }
+    }
+    else if constexpr (op == Op::Unhandled || op == Op::Undecoded) {
+        printUnhandledOpcode(insty.nnn);
+        requestStop(StopReason::Unhandled);
+    }
+    else if constexpr (op == Op::Breakpoint) {
+        if(!resuming_breakpoint && (stop_mask & stopBit(StopReason::Breakpoint))) {
+            pc -= 2;
+            requestStop(StopReason::Breakpoint);
+            return 0;
+        }
+        resuming_breakpoint = false;
+        insty.op = insty.base;
+        return executeDecoded<quirks>(insty);
+    }
+    else { // superinstruction
+        return executeFused<quirks>(typename FusedOps<op>::type{});
+    }
+    return 1;
+}
+
+template<Quirks quirks, Op... ops>
+inline uint32_t Chip8::executeFused(OpList<ops...>) {
+    uint16_t address = pc - 2;
+    uint32_t retired = 0;
+    // && stops at the first instruction that moves pc elsewhere, one that
+    // traps also leaves it out of retired
+    (executeComponent<quirks, ops>(address, retired) && ...);
+    return retired;
+}
+
+// Runs one instruction of a superinstruction as if it had been fetched on
+// its own, with the operands decoded at its address, and moves address on
+template<Quirks quirks, Op op>
+inline bool Chip8::executeComponent(uint16_t& address, uint32_t& retired) {
+    pc = address + 2;
+    retired += execute<quirks, op>(decoded[address]);
+    address += 2;
+    return pc == address;
+}
+
+// Decodes the instruction at address into the cache without resolving
+// superinstructions, op stays Undecoded until fuse has run
+const DecodedInstruction& Chip8::decodeUnfused(uint16_t address) {
+    DecodedInstruction& entry = decoded[address];
+    if(entry.base == Op::Undecoded) {
+        entry = decode(Instruction(emulated_memory[address], emulated_memory[(address+1) & 0xFFF]));
+        entry.op = Op::Undecoded;
+    }
+    return entry;
 }
 
-void Chip8::fetchDecodeExecute() {
+Op Chip8::fuse(uint16_t address) {
+    for(const FusionPattern& pattern : fusion_patterns) {
+        if(address + 2u*pattern.length > emulated_memory.size()) {
+            continue;
+        }
+        uint8_t matched = 0;
+        while(matched < pattern.length && decodeUnfused(address + 2*matched).base == pattern.ops[matched]
+              && (matched == 0 || !breakpoints[address + 2*matched])) {
+            matched++;
+        }
+        if(matched == pattern.length) {
+            return pattern.fused;
+        }
+    }
+    return decoded[address].base;
+}
+
+inline bool Chip8::fetch(DecodedInstruction& insty, uint32_t budget) {
+    if (stop_requested) {
+        return false;
+    }
     if (pc >= 4096) {
-        fmt::print("Out of bounds pc\n");
-        is_running = false;
-        return;
+        trap(ExitReason::Error, "Out of bounds pc");
+        return false;
     }
 
-    //fetch
-    const Instruction insty(emulated_memory[pc], emulated_memory[pc+1]);
+    //decode only on a cache miss
+    DecodedInstruction& cached = decoded[pc];
+    if(cached.op == Op::Undecoded) {
+        decodeUnfused(pc);
+        cached.op = breakpoints[pc] ? Op::Breakpoint : fuse(pc);
+    }
+    insty = cached;
+    // superinstructions only run when the budget covers all of them
+    if(op_lengths[static_cast<std::size_t>(insty.op)] > budget) {
+        insty.op = insty.base;
+    }
 
     pc += 2;
+    return true;
+}
 
-    //decode
-    const auto first_nibble = insty.getFirstNibble();
-    switch(first_nibble){
-        case 0x0:
-            if(insty.whole == 0x00E0) {
-                // clear screen
-                framebuffer.fill(false);
-                frame_dirty = true;
-            }
-            else if(insty.whole == 0x00EE) {
-                // return from subroutine
-                pc = stack.top();
-                stack.pop();
-            }
-            else {
-                // 0NNN execute subroutine
-                // do not implement
-                printUnhandledOpcode(insty);
-            }
-            break;
-        case 0x1: // 1NNN jump
-            pc = insty.getLastThreeNibbles();
-            break;
-        case 0x2: // 2NNN call subroutine
-            stack.push(pc);
-            pc = insty.getLastThreeNibbles();
-            break;
-        case 0x3: // 3XNN skip equal
-            if(VX_reg[insty.getSecondNibble()] == insty.getSecondByte()) {
-                pc += 2;
-            }
-            break;
-        case 0x4: // 4XNN skip not equal
-            if(VX_reg[insty.getSecondNibble()] != insty.getSecondByte()) {
-                pc += 2;
-            }
-            break;
-        case 0x5: // 5XY0 skip if Vx == Vy
-            if(VX_reg[insty.getSecondNibble()] == VX_reg[insty.getThirdNibble()]) {
-                pc += 2;
-            }
-            break;
-        case 0x9: // 9XY0 skip if Vx != Vy
-            if(VX_reg[insty.getSecondNibble()] != VX_reg[insty.getThirdNibble()]) {
-                pc += 2;
-            }
-            break;
-        case 0x6: // 6XNN set register VX
-            VX_reg[insty.getSecondNibble()] = insty.getSecondByte();
+void Chip8::setCpuBackend(CpuBackend backend) {
+    if(backend == CpuBackend::Jit && !JitX64::isSupported()) {
+        fmt::print("JIT not supported on this host, using the threaded interpreter\n");
+        backend = CpuBackend::Threaded;
+    }
+    if(backend == CpuBackend::Jit && !jit) {
+        jit = std::make_unique<JitX64>(*this);
+    }
+    if(backend == CpuBackend::Aot && !aot) {
+        fmt::print("No AOT program loaded, using the switch interpreter\n");
+        backend = CpuBackend::Switch;
+    }
+    cpu_backend = backend;
+}
+
+void Chip8::setQuirks(Quirks quirks) {
+    this->quirks = quirks % quirk_combinations;
+}
+
+void Chip8::setClock(Clock& clock) {
+    pacing_clock = &clock;
+}
+
+void Chip8::setSeed(uint32_t seed) {
+    randy.seed(seed);
+}
+
+void Chip8::setAotProgram(const AotProgram& program) {
+    aot = std::make_unique<AotRunner>(program, *this);
+    cpu_backend = CpuBackend::Aot;
+}
+
+// Nothing a waiting loop does can change before the timers tick or a key
+// changes, both of which happen between calls to tickCPU. When pc sits in
+// one, the state it would reach after cycles instructions is set directly.
+bool Chip8::skipIdleLoop(uint32_t cycles) {
+    if(cycles == 0 || pc > 4094) {
+        return false;
+    }
+    const auto opcodeAt = [this](int address) {
+        return Instruction(emulated_memory[address], emulated_memory[address+1]);
+    };
+
+    if(isSelfJump()) {
+        return true;
+    }
+
+    // FX0A without a pressed key only rewinds pc
+    if((opcodeAt(pc).whole & 0xF0FF) == 0xF00A) {
+        return std::none_of(std::begin(key), std::end(key), [](bool pressed) { return pressed; });
+    }
+
+    // FX07 3X00 1NNN jumping back to the FX07 spins until the delay timer runs out
+    for(int position = 0; position < 3; position++) {
+        const int head = pc - 2*position;
+        if(head < 0 || head + 6 > static_cast<int>(emulated_memory.size())) {
+            continue;
+        }
+        const uint8_t x = opcodeAt(head).getSecondNibble();
+        if(opcodeAt(head).whole != (0xF007 | x << 8)
+            || opcodeAt(head+2).whole != (0x3000 | x << 8)
+            || opcodeAt(head+4).whole != (0x1000 | head)) {
+            continue;
+        }
+        // at the 3X00, VX still holds the timer as read before the last tick
+        if(delay_timer == 0 || (position == 1 && VX_reg[x] == 0)) {
+            return false;
+        }
+        const uint32_t until_read = (3 - position) % 3;
+        if(cycles > until_read) {
+            VX_reg[x] = delay_timer;
+        }
+        pc = head + 2*((position + cycles) % 3);
+        return true;
+    }
+    return false;
+}
+
+bool Chip8::isSelfJump() const {
+    return pc <= 4094 && Instruction(emulated_memory[pc], emulated_memory[pc+1]).whole == (0x1000 | pc);
+}
+
+RunResult Chip8::run(uint32_t budget, StopMask stop_mask) {
+    const NoAllocationScope no_allocations;
+
+    if(!is_running) {
+        return {StopReason::Stopped, 0};
+    }
+    this->stop_mask = stop_mask;
+    stop_reason = StopReason::Budget;
+    stop_requested = false;
+    resuming_breakpoint = pc < breakpoints.size() && breakpoints[pc];
+
+    // skipping a waiting loop would also skip breakpoints inside it
+    const bool breaks = (stop_mask & stopBit(StopReason::Breakpoint)) && breakpoints.any();
+    is_idle = !breaks && skipIdleLoop(budget);
+    // with the timers run out, nothing but a reset gets the program out of a jump to itself
+    is_halted = is_idle && delay_timer == 0 && sound_timer == 0 && isSelfJump();
+    if(is_idle) {
+        if(is_halted && exit_reason == ExitReason::None) {
+            exit_reason = ExitReason::Finished;
+        }
+        if(isSelfJump()) {
+            requestStop(StopReason::Halt);
+        }
+        else if((Instruction(emulated_memory[pc], emulated_memory[pc+1]).whole & 0xF0FF) == 0xF00A) {
+            requestStop(StopReason::KeyWait);
+        }
+        this->stop_mask = 0;
+        return {stop_reason, budget};
+    }
+
+    using Loop = uint32_t (Chip8::*)(uint32_t);
+    static constexpr Loop switch_loops[] = {
+#define X(quirks) &Chip8::runSwitch<quirks>,
+        CHIP8_QUIRK_MASKS(X)
+#undef X
+    };
+    static constexpr Loop threaded_loops[] = {
+#define X(quirks) &Chip8::runThreaded<quirks>,
+        CHIP8_QUIRK_MASKS(X)
+#undef X
+    };
+    static_assert(std::size(switch_loops) == quirk_combinations);
+
+    uint32_t cycles = 0;
+    switch(cpu_backend) {
+        case CpuBackend::Switch:
+            cycles = (this->*switch_loops[quirks])(budget);
             break;
-        case 0x7: // 7XNN add value to register VX
-            VX_reg[insty.getSecondNibble()] += insty.getSecondByte();
+        case CpuBackend::Threaded:
+            cycles = (this->*threaded_loops[quirks])(budget);
             break;
-        case 0x8:
-            switch(insty.getFourthNibble()) {
-                case 0x0: // 8XY0 set
-                    VX_reg[insty.getSecondNibble()] = VX_reg[insty.getThirdNibble()];
-                    break;
-                case 0x1: // 8XY1 bitwise logical OR
-                    VX_reg[insty.getSecondNibble()] = VX_reg[insty.getSecondNibble()] | VX_reg[insty.getThirdNibble()];
-                    break;
-                case 0x2: // 8XY2 bitwise logical AND
-                    VX_reg[insty.getSecondNibble()] = VX_reg[insty.getSecondNibble()] & VX_reg[insty.getThirdNibble()];
-                    break;
-                case 0x3: // 8XY3 bitwise logical XOR
-                    VX_reg[insty.getSecondNibble()] = VX_reg[insty.getSecondNibble()] ^ VX_reg[insty.getThirdNibble()];
-                    break;
-                case 0x4: // 8XY4 add
-                    {
-                        const uint16_t sum = static_cast<uint16_t>(VX_reg[insty.getSecondNibble()]) + VX_reg[insty.getThirdNibble()];
-                        VX_reg[0xF] = (sum > 255);
-                        VX_reg[insty.getSecondNibble()] = static_cast<uint8_t>(sum % 256);
-                    }
-                    break;
-                case 0x5: // 8XY5 subtract
-                    {
-                        const uint8_t vx = VX_reg[insty.getSecondNibble()];
-                        const uint8_t vy = VX_reg[insty.getThirdNibble()];
-                        VX_reg[insty.getSecondNibble()] = vx - vy;
-                        VX_reg[0xF] = (vx >= vy);
-                    }
-                    break;
-                case 0x7: // 8XY7 subtract
-                    {
-                        const uint8_t vx = VX_reg[insty.getSecondNibble()];
-                        const uint8_t vy = VX_reg[insty.getThirdNibble()];
-                        VX_reg[insty.getSecondNibble()] = vy - vx;
-                        VX_reg[0xF] = (vy >= vx);
-                    }
-                    break;
-                case 0x6: //8XY6 right shift
-#ifndef CHIP8_NEW_SHIFT
-                    VX_reg[insty.getSecondNibble()] = VX_reg[insty.getThirdNibble()];
-#endif
-                    VX_reg[0xF] = VX_reg[insty.getSecondNibble()] & 1;
-                    VX_reg[insty.getSecondNibble()] = VX_reg[insty.getSecondNibble()] >> 1;
-                    break;
-                case 0xE: //8XYE left shift
-#ifndef CHIP8_NEW_SHIFT
-                    VX_reg[insty.getSecondNibble()] = VX_reg[insty.getThirdNibble()];
-#endif
-                    VX_reg[0xF] = (VX_reg[insty.getSecondNibble()] & 0x80) >> 7;
-                    VX_reg[insty.getSecondNibble()] = VX_reg[insty.getSecondNibble()] << 1;
-                    break;
-                default:
-                    printUnhandledOpcode(insty);
-            }
+        case CpuBackend::Jit:
+            cycles = jit->run(*this, budget);
             break;
-        case 0xA: // ANNN set index register I
-            I_reg = insty.getLastThreeNibbles();
+        case CpuBackend::Aot:
+            cycles = aot->run(*this, budget);
             break;
-        case 0xB: // BNNN jump with offset
-#ifdef CHIP8_QUIRKY_JUMP
-            pc = insty.getLastThreeNibbles() + VX_reg[insty.getSecondNibble()];
+    }
+
+    // outside a run, fetch only fails once the machine stopped
+    const RunResult result{stop_reason, cycles};
+    this->stop_mask = 0;
+    stop_requested = !is_running;
+    return result;
+}
+
+void Chip8::tickCPU(uint32_t cycles) {
+    run(cycles, 0);
+}
+
+RunResult Chip8::runTick(StopMask stop_mask) {
+    const RunResult result = run(clock.cyclesUntilTick(), stop_mask);
+    if(clock.advance(result.cycles)) {
+        tickDelayTimer();
+        tickSoundTimer();
+    }
+    return result;
+}
+
+uint32_t Chip8::fetchDecodeExecute() {
+    DecodedInstruction insty;
+    if(fetch(insty, 1)) {
+        return executeDecoded(insty);
+    }
+    return 0;
+}
+
+// Runs one instruction with the current quirks, for callers outside the
+// interpreter loops
+uint32_t Chip8::executeDecoded(DecodedInstruction insty) {
+    using Handler = uint32_t (Chip8::*)(DecodedInstruction);
+    static constexpr Handler handlers[] = {
+#define X(quirks) &Chip8::executeDecoded<quirks>,
+        CHIP8_QUIRK_MASKS(X)
+#undef X
+    };
+    return (this->*handlers[quirks])(insty);
+}
+
+template<Quirks quirks>
+uint32_t Chip8::executeDecoded(DecodedInstruction insty) {
+    switch(insty.op){
+#define X(name) \
+        case Op::name: \
+            return execute<quirks, Op::name>(insty);
+#define FUSED(name, ...) X(name)
+        CHIP8_OPS(X)
+        CHIP8_FUSED_OPS(FUSED)
+#undef FUSED
+#undef X
+    }
+    return 0;
+}
+
+template<Quirks quirks>
+uint32_t Chip8::runSwitch(uint32_t cycles) {
+    DecodedInstruction insty;
+    uint32_t i = 0;
+    while(i < cycles && fetch(insty, cycles - i)) {
+        i += executeDecoded<quirks>(insty);
+    }
+    return i;
+}
+
+// Every handler ends in its own indirect jump to the next one, so the host
+// predicts each opcode from the one before it instead of from a single switch.
+template<Quirks quirks>
+uint32_t Chip8::runThreaded(uint32_t cycles) {
+    DecodedInstruction insty;
+    uint32_t remaining = cycles;
+
+#if defined(__GNUC__)
+    static void* const dispatch_table[] = {
+#define X(name) &&op_##name,
+#define FUSED(name, ...) X(name)
+        CHIP8_OPS(X)
+        CHIP8_FUSED_OPS(FUSED)
+#undef FUSED
+#undef X
+    };
+    static_assert(std::size(dispatch_table) == op_count);
+
+#define DISPATCH() \
+    if(remaining == 0 || !fetch(insty, remaining)) { \
+        return cycles - remaining; \
+    } \
+    goto *dispatch_table[static_cast<std::size_t>(insty.op)]
+
+    DISPATCH();
+#define X(name) \
+    op_##name: \
+        remaining -= execute<quirks, Op::name>(insty); \
+        DISPATCH();
+#define FUSED(name, ...) X(name)
+    CHIP8_OPS(X)
+    CHIP8_FUSED_OPS(FUSED)
+#undef FUSED
+#undef X
+#undef DISPATCH
 #else
-            pc = insty.getLastThreeNibbles() + VX_reg[0];
-#endif
-            break;
-        case 0xC: // CXNN random
-            VX_reg[insty.getSecondNibble()] = randy() & insty.getSecondByte();
-            break;
-        case 0xD: // DXYN display/draw
-        {
-            const int x = VX_reg[insty.getSecondNibble()] % nWidth;
-            const int y = VX_reg[insty.getThirdNibble()] % nHeight;
-            const int n = insty.getFourthNibble();
-            bool unset = false;
-
-            frame_mutex.lock();
-            for(int i=0; i<n; i++) {
-                uint8_t sprite = emulated_memory[I_reg+i];
-                for(int j=0; j<8; j++) {
-                    bool bit = (sprite >> (7-j)) & 1;
-                    int i_y = y+i;
-                    int j_x = x+j;
-                    if (i_y < nHeight && j_x < nWidth) {
-                        bool fbit = framebuffer[i_y * nWidth + j_x];
-                        if(bit && fbit) {
-                            unset = true;
-                        }
-                        framebuffer[i_y * nWidth + j_x] = bit ^ fbit;
-                    }
-                }
-            }
-            frame_mutex.unlock();
-            VX_reg[0xF] = unset;
+    // No computed goto, fall back to a handler table
+    using Handler = uint32_t (Chip8::*)(DecodedInstruction);
+    static constexpr Handler handlers[] = {
+#define X(name) &Chip8::execute<quirks, Op::name>,
+#define FUSED(name, ...) X(name)
+        CHIP8_OPS(X)
+        CHIP8_FUSED_OPS(FUSED)
+#undef FUSED
+#undef X
+    };
+    static_assert(std::size(handlers) == op_count);
 
-            frame_dirty = true;
-        }
-            break;
-        case 0xE:
-            if(insty.getSecondByte() == 0x9E) { // EX9E skip if key pressed
-                if(key[VX_reg[insty.getSecondNibble()]]) {
-                    pc += 2;
-                }
-            }
-            else if(insty.getSecondByte() == 0xA1) { // EXA1 skip if key not pressed
-                if(!key[VX_reg[insty.getSecondNibble()]]) {
-                    pc += 2;
-                }
-            }
-            else {
-                printUnhandledOpcode(insty);
-            }
-            break;
-        case 0xF:
-            switch(insty.getSecondByte()) {
-                case 0x07: // FX07 get delay timer
-                    VX_reg[insty.getSecondNibble()] = delay_timer;
-                    break;
-                case 0x15: // FX15 set delay timer
-                    delay_timer = VX_reg[insty.getSecondNibble()];
-                    break;
-                case 0x18: // FX18 set sound timer
-                    sound_timer = VX_reg[insty.getSecondNibble()];
-                    break;
-                case 0x0A: // FX0A get key
-                    {
-                        bool pressed = false;
-                        for (int i=0; i<16; i++) {
-                            if(key[i]){
-                                pressed = true;
-                                VX_reg[insty.getSecondNibble()] = i;
-                                break;
-                            }
-                        }
-                        if(!pressed)
-                            pc-=2;
-                    }
-                    break;
-                case 0x1E: // FX1E add to index
-                    {
-                    I_reg += VX_reg[insty.getSecondNibble()];
-                    }
-                    break;
-                case 0x29: // FX29 font character
-                    {
-                    const uint8_t x = VX_reg[insty.getSecondNibble()];
-                    I_reg = font_starting_address + 5*(x & 0xF);
-                    }
-                    break;
-                case 0x33: // FX33 decimal conversion
-                    {
-                    const uint8_t number = VX_reg[insty.getSecondNibble()];
-                    emulated_memory[I_reg] = number / 100;
-                    emulated_memory[I_reg+1] = (number % 100) / 10;
-                    emulated_memory[I_reg+2] = number % 10;
-                    }
-                    break;
-                case 0x55: // FX55 store in memory
-                    {
-                    const uint8_t x = insty.getSecondNibble();
-                    for(int i=0; i<=x; i++) {
-                        emulated_memory[I_reg+i] = VX_reg[i];
-                    }
-#ifdef CHIP8_LOAD_STORE
-                    I_reg += x;
-#endif
-                    }
-                    break;
-                case 0x65: // FX65 load from memory
-                    {
-                    const uint8_t x = insty.getSecondNibble();
-                    for(int i=0; i<=x; i++) {
-                        VX_reg[i] = emulated_memory[I_reg+i];
-                    }
-#ifdef CHIP8_LOAD_STORE
-                    I_reg += x;
-#endif
-                    }
-                    break;
-                default:
-                    printUnhandledOpcode(insty);
-            }
-            break;
-        default:
-            printUnhandledOpcode(insty);
+    while(remaining > 0 && fetch(insty, remaining)) {
+        remaining -= (this->*handlers[static_cast<std::size_t>(insty.op)])(insty);
     }
+    return cycles - remaining;
+#endif
 }
 
+// Emulation runs one timer tick at a time, then waits for real time to
+// catch up with it
 void Chip8::mainLoop() {
-    const uint32_t default_sleep = 16666u;
-    uint32_t recommended_sleep = default_sleep;
+    FramePacer pacer(*pacing_clock);
+    Chip8State past;
     while(is_running) {
-        using namespace std::chrono;
-        auto current_time = system_clock::now().time_since_epoch();
-        auto time_difference = duration_cast<microseconds>(current_time - timer_previous_time).count();
-        if(time_difference > 16666) { // 60Hz, 16.666ms
-            tickCPU(16666u/micro_wait);
-            tickDelayTimer();
-            tickSoundTimer();
-            timer_previous_time = current_time;
+        if(rewinding && rewind_buffer && !recording && !movie_player) {
+            if(rewind_buffer->stepBack(past)) {
+                // keys held now stay held, only the machine goes back. A
+                // shutDown that came in meanwhile still ends the loop.
+                std::copy(std::begin(key), std::end(key), std::begin(past.key));
+                restoreState(past);
+            }
+            pacer.waitForNextTick();
+            continue;
         }
-        else {
-            recommended_sleep = std::min(recommended_sleep, static_cast<uint32_t>(time_difference / 2u));
+        applyInput();
+        runTick();
+        if(rewind_buffer) {
+            rewind_buffer->push(*this);
         }
-
-        if(recommended_sleep > default_sleep / 2) {
-            std::this_thread::sleep_for(std::chrono::microseconds(default_sleep / 2));
+        // a movie may still change keys while the program waits for them
+        if(is_halted && !(movie_player && !movie_player->finished())) {
+            // only input or shutDown can make a difference now
+            std::unique_lock<std::mutex> lock(halt_mutex);
+            halt_wakeup.wait(lock, [this] { return wakeup_pending; });
+            wakeup_pending = false;
+            pacer.reset();
+            continue;
         }
-        recommended_sleep = default_sleep;
+        pacer.waitForNextTick();
     }
 }
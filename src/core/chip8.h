@@ -1,42 +1,236 @@
 #pragma once
 
 #include <array>
-#include <chrono>
-#include <stack>
+#include <atomic>
+#include <bitset>
+#include <condition_variable>
 #include <cstdint>
+#include <memory>
 #include <mutex>
-#include <random>
+#include <optional>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "clock.h"
+#include "decoder.h"
+#include "jit_x64.h"
+#include "random.h"
+
+struct AotProgram;
+class AotRunner;
+struct Movie;
+class MoviePlayer;
+class RewindBuffer;
 
 //Native screen dimensions
 constexpr unsigned int nWidth = 64;
 constexpr unsigned int nHeight = 32;
 
-class Chip8 {
+// Interpreter used by tickCPU
+enum class CpuBackend {
+    Switch,   // one switch over the decoded op per instruction
+    Threaded, // computed goto between handlers where the compiler supports it
+    Jit,      // x86-64 translation of basic blocks, threaded on other hosts
+    Aot,      // blocks translated ahead of time by pof-aot, see setAotProgram
+};
+
+std::optional<CpuBackend> cpuBackendFromName(std::string_view name);
+
+// Behaviour that differs between CHIP-8 variants, a mask of the quirk_ flags.
+// The core is instantiated for every combination, see setQuirks.
+using Quirks = uint8_t;
+constexpr Quirks quirk_new_shift = 1 << 0;   // 8XY6/8XYE shift VX in place instead of VY into VX
+constexpr Quirks quirk_quirky_jump = 1 << 1; // BNNN jumps to XNN + VX instead of NNN + V0
+constexpr Quirks quirk_load_store = 1 << 2;  // FX55/FX65 advance I
+constexpr std::size_t quirk_combinations = 1 << 3;
+constexpr Quirks default_quirks = quirk_new_shift;
+
+// "modern", "cosmac" or "schip"
+std::optional<Quirks> quirksFromName(std::string_view name);
+
+// Why the program stopped making progress
+enum class ExitReason {
+    None,     // still running
+    Finished, // halted in a jump to itself
+    Shutdown, // shutDown was called
+    Error,    // pc left memory
+    StackOverflow,  // 2NNN with all 16 stack entries in use
+    StackUnderflow, // 00EE with an empty stack
+};
+
+// Why run returned
+enum class StopReason {
+    Budget,     // ran the whole budget
+    FrameDrawn, // after 00E0 or DXYN
+    KeyWait,    // at FX0A without a pressed key
+    SoundStart, // after FX18 started the sound timer
+    Halt,       // at a jump to itself
+    Breakpoint, // at an address passed to setBreakpoint, before running it
+    Unhandled,  // after an unhandled opcode
+    Stopped,    // the machine is not running, see exitReason
+};
+
+// Reasons run may return early for, a mask of stopBit. Budget and Stopped always apply.
+using StopMask = uint8_t;
+constexpr StopMask stopBit(StopReason reason) {
+    return static_cast<StopMask>(1u << static_cast<unsigned>(reason));
+}
+constexpr StopMask stop_all = 0xFF;
+
+struct RunResult {
+    StopReason reason;
+    uint32_t cycles; // instructions run
+};
+
+// Architectural state of a machine. It is trivially copyable, so a
+// snapshot is a single copy. A restore copies it back too, but first
+// compares memory in chunks to drop cached code that changed, see
+// Chip8::restore.
+struct Chip8State {
+    uint16_t pc = 512; //12 bits
+
+    uint16_t I_reg = 0; //I register
+    uint8_t VX_reg[16] = {0}; //VX registers
+
+    std::array<uint8_t, 4096> emulated_memory = { 0 };
+
+    std::array<uint16_t, 16> stack = { 0 };
+    uint8_t stack_size = 0;
+
+    uint8_t delay_timer = 0;
+    uint8_t sound_timer = 0;
+
+    bool key[16] = {false}; // pressed keys
+
+    Pcg32 randy; // CXNN, seeded from std::random_device until setSeed
+
+    CycleClock clock; // CPU cycles and timer ticks emulated so far
+
+    std::array<uint64_t, nHeight> framebuffer = {0}; // a word per row, bit 63 is x = 0
+};
+
+static_assert(std::is_trivially_copyable_v<Chip8State>);
+
+// FNV-1a over the rows, to compare screens between runs
+uint64_t frameHash(const Chip8State& state);
+
+class Chip8 : private Chip8State {
     public:
     Chip8();
+    ~Chip8();
     void mainLoop();
 
+    // loads a program at 0x200
+    void loadProgram(const std::vector<uint8_t>& program);
+
+    // from the thread running the machine, others use queueKey
     void setKey(uint8_t n, bool state);
+    // Hands a key change to mainLoop, which applies it at the next timer tick.
+    // Input from another thread then only changes the run at tick boundaries,
+    // where a movie can record and replay it. A key changes at most once a
+    // tick, so a quick tap still lasts a tick.
+    void queueKey(uint8_t n, bool state);
+    // appends every key change from here on to movie, which must outlive the recording
+    void startRecording(Movie& movie);
+    void stopRecording();
+    // mainLoop takes input from the movie instead of queueKey. The machine
+    // must be set up as the movie was recorded, see setUpForMovie.
+    void play(const Movie& movie);
+    // mainLoop keeps the states of past frames within budget_bytes, 0 turns it off
+    void enableRewind(std::size_t budget_bytes);
+    // While set, mainLoop steps back a frame each tick instead of running,
+    // unless a movie is recording or playing. Safe from any thread.
+    void setRewinding(bool rewinding);
 
     void setCoreFrequency(int f);
+    void setCpuBackend(CpuBackend backend);
+    void setQuirks(Quirks quirks);
+    // CXNN draws the same numbers on every run with the same seed
+    void setSeed(uint32_t seed);
+    // selects CpuBackend::Aot, call after loading the program it was translated from.
+    // Blocks that writes or breakpoints touch are interpreted until their code
+    // matches the program again, see AotRunner.
+    void setAotProgram(const AotProgram& program);
+    // paces mainLoop, real time by default. It must outlive the machine.
+    void setClock(Clock& clock);
 
     bool frameAt(uint8_t x, uint8_t y) const;
+    // bit 63 is x = 0
+    uint64_t frameRow(uint8_t y) const;
+    // FNV-1a over the rows, to compare screens between runs
+    uint64_t frameHash() const;
+
+    // emulated CPU cycles so far
+    uint64_t cycles() const;
+
+    Chip8State snapshot() const;
+    // caches of code that differs from the current memory are invalidated,
+    // and a stopped machine runs again
+    void restore(const Chip8State& state);
+
+    void setBreakpoint(uint16_t address);
+    void clearBreakpoint(uint16_t address);
 
     bool isFrameDirty() const;
     void clearDirty();
 
     bool isRunning() const;
+    // whether the last tickCPU only spun in a loop waiting for a timer or key
+    bool isIdle() const;
+    // whether the program ended in a jump to itself with the timers run out
+    bool isHalted() const;
+    ExitReason exitReason() const;
     void shutDown();
 
     void tickDelayTimer();
     void tickSoundTimer();
+    // Runs up to budget instructions, returning early after an event in stop_mask.
+    // A program waiting for a key or halted spends the whole budget, as it would spinning.
+    RunResult run(uint32_t budget, StopMask stop_mask);
     void tickCPU(uint32_t cycles);
-    void fetchDecodeExecute();
+    // Runs the CPU to the next 60 Hz timer tick in emulated time and ticks the timers.
+    // Returns early on an event in stop_mask, the next call carries on with the same tick.
+    RunResult runTick(StopMask stop_mask = 0);
+    // returns the instructions retired
+    uint32_t fetchDecodeExecute();
 
     private:
     void beep();
+    void applyInput();
+    // the part of restore that leaves the run and exit flags alone
+    void restoreState(const Chip8State& state);
+
+    void trap(ExitReason reason, std::string_view message);
+    void requestStop(StopReason reason);
+    bool skipIdleLoop(uint32_t cycles);
+    bool isSelfJump() const;
+    void wakeUp();
+    bool fetch(DecodedInstruction& insty, uint32_t budget);
+    const DecodedInstruction& decodeUnfused(uint16_t address);
+    Op fuse(uint16_t address);
+    // handlers return the instructions they retired, an instruction that traps retires none
+    template<Quirks quirks, Op op>
+    uint32_t execute(DecodedInstruction insty);
+    template<Quirks quirks, Op... ops>
+    uint32_t executeFused(OpList<ops...>);
+    template<Quirks quirks, Op op>
+    bool executeComponent(uint16_t& address, uint32_t& retired);
+    template<Quirks quirks>
+    uint32_t executeDecoded(DecodedInstruction insty);
+    uint32_t executeDecoded(DecodedInstruction insty);
+    // the loops return the instructions retired
+    template<Quirks quirks>
+    uint32_t runSwitch(uint32_t cycles);
+    template<Quirks quirks>
+    uint32_t runThreaded(uint32_t cycles);
+
+    void writeMemory(uint16_t address, uint8_t value);
+    void invalidateDecoded(uint16_t address, uint16_t length);
 
-    friend void loadChip8Program(Chip8& chip, std::string filename);
+    friend class JitX64;
+    friend class AotRunner;
 
     // variables from here
     public:
@@ -44,25 +238,37 @@ class Chip8 {
     bool frame_dirty = true; //indicates the framebuffer was modified
 
     private:
-    uint16_t pc = 512; //12 bits
-
-    uint16_t I_reg = 0; //I register
-    uint8_t VX_reg[16] = {0}; //VX registers
-
-    std::array<uint8_t, 4096> emulated_memory = { 0 };
+    std::array<DecodedInstruction, 4096> decoded{}; //predecoded emulated_memory, one entry per address
 
-    std::stack<uint16_t> stack;
-
-    uint8_t delay_timer = 0;
-    uint8_t sound_timer = 0;
+    bool is_running = true;
+    bool is_idle = false;
+    bool is_halted = false;
+    ExitReason exit_reason = ExitReason::None;
 
-    bool key[16] = {false}; // pressed keys
+    // stop conditions of the current run, handlers raise them
+    StopMask stop_mask = 0;
+    StopReason stop_reason = StopReason::Budget;
+    bool stop_requested = false; // fetch fails until the run returns
+    bool resuming_breakpoint = false; // the run started on a breakpoint, which it runs instead of stopping at
+    std::bitset<4096> breakpoints;
 
-    std::array<bool, nWidth*nHeight> framebuffer = {false};
+    // key changes queued for the next tick of mainLoop
+    std::mutex input_mutex;
+    std::vector<std::pair<uint8_t, bool>> queued_keys;
+    Movie* recording = nullptr;
+    std::unique_ptr<MoviePlayer> movie_player;
+    std::unique_ptr<RewindBuffer> rewind_buffer;
+    std::atomic<bool> rewinding{false};
 
-    bool is_running = true;
+    // mainLoop blocks on this while halted, until input or shutdown
+    std::mutex halt_mutex;
+    std::condition_variable halt_wakeup;
+    bool wakeup_pending = false;
 
-    uint32_t micro_wait = 1428; // default 700Hz, 1.428ms
+    Clock* pacing_clock = &realTimeClock();
+    Quirks quirks = default_quirks;
+    CpuBackend cpu_backend = CpuBackend::Switch;
+    std::unique_ptr<JitX64> jit; // created on first use of CpuBackend::Jit
+    std::unique_ptr<AotRunner> aot;
 };
 
-extern Chip8 global_chip;
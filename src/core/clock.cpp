@@ -0,0 +1,70 @@
+#include "clock.h"
+
+#include <algorithm>
+#include <thread>
+
+CycleClock::CycleClock(uint32_t frequency) : cpu_frequency(frequency) {
+    startTick();
+}
+
+void CycleClock::setFrequency(uint32_t frequency) {
+    cpu_frequency = frequency;
+}
+
+uint32_t CycleClock::frequency() const {
+    return cpu_frequency;
+}
+
+uint32_t CycleClock::cyclesUntilTick() const {
+    return tick_cycles - elapsed;
+}
+
+bool CycleClock::advance(uint32_t cycles) {
+    cycles = std::min(cycles, cyclesUntilTick());
+    elapsed += cycles;
+    total_cycles += cycles;
+    if(elapsed < tick_cycles) {
+        return false;
+    }
+    total_ticks++;
+    startTick();
+    return true;
+}
+
+uint64_t CycleClock::cycles() const {
+    return total_cycles;
+}
+
+uint64_t CycleClock::ticks() const {
+    return total_ticks;
+}
+
+void CycleClock::startTick() {
+    const uint32_t sixtieths = cpu_frequency + carry;
+    tick_cycles = sixtieths / timer_frequency;
+    carry = sixtieths % timer_frequency;
+    elapsed = 0;
+}
+
+std::chrono::nanoseconds RealTimeClock::now() {
+    using namespace std::chrono;
+    return duration_cast<nanoseconds>(steady_clock::now().time_since_epoch());
+}
+
+void RealTimeClock::sleepUntil(std::chrono::nanoseconds time) {
+    using namespace std::chrono;
+    std::this_thread::sleep_until(steady_clock::time_point(duration_cast<steady_clock::duration>(time)));
+}
+
+std::chrono::nanoseconds VirtualClock::now() {
+    return current;
+}
+
+void VirtualClock::sleepUntil(std::chrono::nanoseconds time) {
+    current = std::max(current, time);
+}
+
+Clock& realTimeClock() {
+    static RealTimeClock clock;
+    return clock;
+}
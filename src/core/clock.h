@@ -0,0 +1,67 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+
+// Emulated time, counted in CPU cycles. The 60 Hz timers tick at fixed points
+// of it, frequency / 60 cycles apart. The remainder of that division is
+// carried from tick to tick, so over a second the CPU runs exactly its
+// frequency in cycles and the result never depends on the host.
+class CycleClock {
+    public:
+    static constexpr uint32_t timer_frequency = 60;
+
+    explicit CycleClock(uint32_t frequency = 700);
+
+    // takes effect from the next tick
+    void setFrequency(uint32_t frequency);
+    uint32_t frequency() const;
+
+    // cycles left before the next timer tick
+    uint32_t cyclesUntilTick() const;
+    // moves time on by at most cyclesUntilTick(), returns whether the tick was reached
+    bool advance(uint32_t cycles);
+
+    uint64_t cycles() const;
+    uint64_t ticks() const;
+
+    private:
+    void startTick();
+
+    uint32_t cpu_frequency;
+    uint32_t carry = 0; // sixtieths of a cycle left over from earlier ticks
+    uint32_t tick_cycles = 0; // length of the current tick
+    uint32_t elapsed = 0; // cycles into the current tick
+    uint64_t total_cycles = 0;
+    uint64_t total_ticks = 0;
+};
+
+// Host time, as the pacer sees it
+class Clock {
+    public:
+    virtual ~Clock() = default;
+
+    virtual std::chrono::nanoseconds now() = 0;
+    virtual void sleepUntil(std::chrono::nanoseconds time) = 0;
+};
+
+// steady_clock and real sleeps
+class RealTimeClock : public Clock {
+    public:
+    std::chrono::nanoseconds now() override;
+    void sleepUntil(std::chrono::nanoseconds time) override;
+};
+
+// Jumps straight to every deadline, so paced emulation runs as fast as the
+// host can execute it and gives the same results as in real time
+class VirtualClock : public Clock {
+    public:
+    std::chrono::nanoseconds now() override;
+    void sleepUntil(std::chrono::nanoseconds time) override;
+
+    private:
+    std::chrono::nanoseconds current{0};
+};
+
+// shared by every machine that was not given a clock
+Clock& realTimeClock();
@@ -0,0 +1,78 @@
+#include "decoder.h"
+
+namespace {
+    Op decodeOp(Instruction insty) {
+        switch(insty.getFirstNibble()) {
+            case 0x0:
+                if(insty.whole == 0x00E0) {
+                    return Op::ClearScreen;
+                }
+                if(insty.whole == 0x00EE) {
+                    return Op::Return;
+                }
+                // 0NNN execute subroutine
+                // do not implement
+                return Op::Unhandled;
+            case 0x1: return Op::Jump;
+            case 0x2: return Op::Call;
+            case 0x3: return Op::SkipEqualImm;
+            case 0x4: return Op::SkipNotEqualImm;
+            case 0x5: return Op::SkipEqualReg;
+            case 0x6: return Op::SetImm;
+            case 0x7: return Op::AddImm;
+            case 0x8:
+                switch(insty.getFourthNibble()) {
+                    case 0x0: return Op::SetReg;
+                    case 0x1: return Op::Or;
+                    case 0x2: return Op::And;
+                    case 0x3: return Op::Xor;
+                    case 0x4: return Op::AddReg;
+                    case 0x5: return Op::SubReg;
+                    case 0x6: return Op::ShiftRight;
+                    case 0x7: return Op::SubnReg;
+                    case 0xE: return Op::ShiftLeft;
+                    default: return Op::Unhandled;
+                }
+            case 0x9: return Op::SkipNotEqualReg;
+            case 0xA: return Op::SetIndex;
+            case 0xB: return Op::JumpOffset;
+            case 0xC: return Op::Random;
+            case 0xD: return Op::Draw;
+            case 0xE:
+                switch(insty.getSecondByte()) {
+                    case 0x9E: return Op::SkipKey;
+                    case 0xA1: return Op::SkipNotKey;
+                    default: return Op::Unhandled;
+                }
+            case 0xF:
+                switch(insty.getSecondByte()) {
+                    case 0x07: return Op::GetDelay;
+                    case 0x0A: return Op::WaitKey;
+                    case 0x15: return Op::SetDelay;
+                    case 0x18: return Op::SetSound;
+                    case 0x1E: return Op::AddIndex;
+                    case 0x29: return Op::FontChar;
+                    case 0x33: return Op::Bcd;
+                    case 0x55: return Op::Store;
+                    case 0x65: return Op::Load;
+                    default: return Op::Unhandled;
+                }
+        }
+        return Op::Unhandled;
+    }
+} // Anonymous namespace
+
+DecodedInstruction decode(Instruction insty) {
+    DecodedInstruction decoded;
+    decoded.op = decodeOp(insty);
+    decoded.base = decoded.op;
+    decoded.x = insty.getSecondNibble();
+    decoded.y = insty.getThirdNibble();
+    decoded.n = insty.getFourthNibble();
+    decoded.nn = insty.getSecondByte();
+    decoded.nnn = insty.getLastThreeNibbles();
+    if(decoded.op == Op::Unhandled) {
+        decoded.nnn = insty.whole;
+    }
+    return decoded;
+}
@@ -0,0 +1,173 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <initializer_list>
+
+struct Instruction {
+    uint16_t whole{0};
+
+    constexpr Instruction(uint8_t a, uint8_t b) {
+        whole = static_cast<uint16_t>(a) << 8 | b;
+    }
+
+    template<int N>
+    constexpr uint8_t getNibble() const {
+        return (whole >> (4*N)) & 0xF;
+    }
+
+    constexpr uint8_t getFirstNibble() const {
+        return getNibble<3>();
+    }
+    constexpr uint8_t getSecondNibble() const {
+        return getNibble<2>();
+    }
+    constexpr uint8_t getThirdNibble() const {
+        return getNibble<1>();
+    }
+    constexpr uint8_t getFourthNibble() const {
+        return getNibble<0>();
+    }
+
+    constexpr uint16_t getLastThreeNibbles() const {
+        return whole & 0xFFF;
+    }
+
+    template<int N>
+    constexpr uint8_t getByte() const {
+        return (whole >> (8*N)) & 0xFF;
+    }
+
+    constexpr uint8_t getFirstByte() const {
+        return getByte<1>();
+    }
+    constexpr uint8_t getSecondByte() const {
+        return getByte<0>();
+    }
+
+};
+
+// Handler ids of the predecoded instructions, in dispatch table order
+#define CHIP8_OPS(X) \
+    X(Undecoded)        /* decode cache slot is empty or was invalidated */ \
+    X(Unhandled)                                                            \
+    X(Breakpoint)       /* at an address passed to setBreakpoint */         \
+    X(ClearScreen)      /* 00E0 */                                          \
+    X(Return)           /* 00EE */                                          \
+    X(Jump)             /* 1NNN */                                          \
+    X(Call)             /* 2NNN */                                          \
+    X(SkipEqualImm)     /* 3XNN */                                          \
+    X(SkipNotEqualImm)  /* 4XNN */                                          \
+    X(SkipEqualReg)     /* 5XY0 */                                          \
+    X(SetImm)           /* 6XNN */                                          \
+    X(AddImm)           /* 7XNN */                                          \
+    X(SetReg)           /* 8XY0 */                                          \
+    X(Or)               /* 8XY1 */                                          \
+    X(And)              /* 8XY2 */                                          \
+    X(Xor)              /* 8XY3 */                                          \
+    X(AddReg)           /* 8XY4 */                                          \
+    X(SubReg)           /* 8XY5 */                                          \
+    X(ShiftRight)       /* 8XY6 */                                          \
+    X(SubnReg)          /* 8XY7 */                                          \
+    X(ShiftLeft)        /* 8XYE */                                          \
+    X(SkipNotEqualReg)  /* 9XY0 */                                          \
+    X(SetIndex)         /* ANNN */                                          \
+    X(JumpOffset)       /* BNNN */                                          \
+    X(Random)           /* CXNN */                                          \
+    X(Draw)             /* DXYN */                                          \
+    X(SkipKey)          /* EX9E */                                          \
+    X(SkipNotKey)       /* EXA1 */                                          \
+    X(GetDelay)         /* FX07 */                                          \
+    X(WaitKey)          /* FX0A */                                          \
+    X(SetDelay)         /* FX15 */                                          \
+    X(SetSound)         /* FX18 */                                          \
+    X(AddIndex)         /* FX1E */                                          \
+    X(FontChar)         /* FX29 */                                          \
+    X(Bcd)              /* FX33 */                                          \
+    X(Store)            /* FX55 */                                          \
+    X(Load)             /* FX65 */
+
+// Superinstructions: a name followed by the ops of the sequence it replaces.
+// A sequence is fused at its first instruction when that is decoded, and the
+// first pattern that matches wins, so list longer ones first. Only the last
+// op of a sequence may jump, write memory or stop a run, a taken skip ends it
+// early.
+#define CHIP8_FUSED_OPS(X) \
+    X(SetImmSetImmDraw, Op::SetImm, Op::SetImm, Op::Draw)                   /* 6XNN 6YNN DXYN */ \
+    X(AddImmSkipEqualImmJump, Op::AddImm, Op::SkipEqualImm, Op::Jump)       /* 7XNN 3XNN 1NNN */ \
+    X(AddImmSkipNotEqualImmJump, Op::AddImm, Op::SkipNotEqualImm, Op::Jump) /* 7XNN 4XNN 1NNN */ \
+    X(SetIndexAddIndex, Op::SetIndex, Op::AddIndex)                         /* ANNN FX1E */      \
+    X(SetIndexDraw, Op::SetIndex, Op::Draw)                                 /* ANNN DXYN */      \
+    X(LoadAddReg, Op::Load, Op::AddReg)                                     /* FX65 8XY4 */      \
+    X(LoadSetReg, Op::Load, Op::SetReg)                                     /* FX65 8XY0 */
+
+enum class Op : uint8_t {
+#define X(name) name,
+#define FUSED(name, ...) name,
+    CHIP8_OPS(X)
+    CHIP8_FUSED_OPS(FUSED)
+#undef FUSED
+#undef X
+};
+
+constexpr std::size_t op_count = 0
+#define X(name) + 1
+#define FUSED(name, ...) + 1
+    CHIP8_OPS(X)
+    CHIP8_FUSED_OPS(FUSED)
+#undef FUSED
+#undef X
+    ;
+
+// Instructions covered by each op
+constexpr uint8_t op_lengths[] = {
+#define X(name) 1,
+#define FUSED(name, ...) static_cast<uint8_t>(std::initializer_list<Op>{__VA_ARGS__}.size()),
+    CHIP8_OPS(X)
+    CHIP8_FUSED_OPS(FUSED)
+#undef FUSED
+#undef X
+};
+
+constexpr std::size_t max_fused_length = 3;
+
+struct FusionPattern {
+    Op fused;
+    uint8_t length;
+    std::array<Op, max_fused_length> ops;
+};
+
+constexpr FusionPattern fusion_patterns[] = {
+#define FUSED(name, ...) {Op::name, op_lengths[static_cast<std::size_t>(Op::name)], {__VA_ARGS__}},
+    CHIP8_FUSED_OPS(FUSED)
+#undef FUSED
+};
+
+// Compile time list of the ops making up a superinstruction
+template<Op... ops>
+struct OpList {};
+
+template<Op op>
+struct FusedOps;
+
+#define FUSED(name, ...) \
+    template<> \
+    struct FusedOps<Op::name> { \
+        using type = OpList<__VA_ARGS__>; \
+    };
+CHIP8_FUSED_OPS(FUSED)
+#undef FUSED
+
+// An instruction with its operands already extracted
+struct DecodedInstruction {
+    Op op = Op::Undecoded;
+    uint8_t x = 0;
+    uint8_t y = 0;
+    uint8_t n = 0;
+    uint8_t nn = 0;
+    Op base = Op::Undecoded; // op of this instruction alone, differs from op when fused
+    uint16_t nnn = 0; // holds the whole opcode for Op::Unhandled
+};
+
+DecodedInstruction decode(Instruction insty);
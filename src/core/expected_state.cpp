@@ -0,0 +1,103 @@
+#include "expected_state.h"
+
+#include <algorithm>
+#include <fstream>
+#include <iterator>
+#include <set>
+#include <sstream>
+
+#include <fmt/core.h>
+
+void setExpectedState(ExpectedState& expected, const Chip8State& state) {
+    expected.pc = state.pc;
+    expected.I_reg = state.I_reg;
+    std::copy(std::begin(state.VX_reg), std::end(state.VX_reg), expected.VX_reg.begin());
+    expected.frame_hash = frameHash(state);
+    expected.memory_hash = memoryHash(state);
+}
+
+uint64_t memoryHash(const Chip8State& state) {
+    uint64_t hash = 0xCBF29CE484222325u;
+    for (const uint8_t byte : state.emulated_memory) {
+        hash = (hash ^ byte) * 0x100000001B3u;
+    }
+    return hash;
+}
+
+bool writeExpectedState(const std::string& filename, const std::string& header, const ExpectedState& expected) {
+    std::ofstream file(filename);
+    file << header;
+    file << fmt::format("frequency {}\nquirks {}\nticks {}\ninstructions {}\n",
+                        expected.frequency, expected.quirks, expected.ticks, expected.instructions);
+    file << fmt::format("pc {:03X}\nI {:03X}\nV", expected.pc, expected.I_reg);
+    for (const uint8_t value : expected.VX_reg) {
+        file << fmt::format(" {:02X}", value);
+    }
+    file << fmt::format("\nframe {:016x}\nmemory {:016x}\n", expected.frame_hash, expected.memory_hash);
+    if (!file) {
+        fmt::print("Could not write {}\n", filename);
+        return false;
+    }
+    return true;
+}
+
+bool readExpectedState(const std::string& filename, ExpectedState& expected) {
+    std::ifstream file(filename);
+    if (!file.is_open()) {
+        fmt::print("Could not open {}\n", filename);
+        return false;
+    }
+    const std::set<std::string> keys = {"frequency", "quirks", "ticks", "instructions", "pc", "I", "V", "frame", "memory"};
+    std::set<std::string> seen;
+    std::string line;
+    for (int number = 1; std::getline(file, line); number++) {
+        line = line.substr(0, line.find('#'));
+        std::istringstream fields(line);
+        std::string key;
+        if (!(fields >> key)) {
+            continue;
+        }
+        unsigned quirks = 0;
+        unsigned pc = 0;
+        unsigned index = 0;
+        bool read = false;
+        if (key == "frequency") {
+            read = static_cast<bool>(fields >> expected.frequency);
+        } else if (key == "quirks") {
+            read = static_cast<bool>(fields >> quirks);
+            expected.quirks = static_cast<Quirks>(quirks);
+        } else if (key == "ticks") {
+            read = static_cast<bool>(fields >> expected.ticks);
+        } else if (key == "instructions") {
+            read = static_cast<bool>(fields >> expected.instructions);
+        } else if (key == "pc") {
+            read = static_cast<bool>(fields >> std::hex >> pc);
+            expected.pc = static_cast<uint16_t>(pc);
+        } else if (key == "I") {
+            read = static_cast<bool>(fields >> std::hex >> index);
+            expected.I_reg = static_cast<uint16_t>(index);
+        } else if (key == "V") {
+            read = true;
+            for (uint8_t& value : expected.VX_reg) {
+                unsigned byte = 0;
+                read = read && (fields >> std::hex >> byte);
+                value = static_cast<uint8_t>(byte);
+            }
+        } else if (key == "frame") {
+            read = static_cast<bool>(fields >> std::hex >> expected.frame_hash);
+        } else if (key == "memory") {
+            read = static_cast<bool>(fields >> std::hex >> expected.memory_hash);
+        }
+        if (!read) {
+            fmt::print("{}:{}: expected one of frequency, quirks, ticks, instructions, pc, I, V, frame or memory with its value\n",
+                       filename, number);
+            return false;
+        }
+        seen.insert(key);
+    }
+    if (seen != keys) {
+        fmt::print("{}: some of the state is missing\n", filename);
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <string>
+
+#include "chip8.h"
+
+// The state a stress ROM of pof-romgen halts in, and the run that reached
+// it. pof-romgen writes it next to the ROM as <rom>.expected and
+// pof-lockstep checks the core against it.
+struct ExpectedState {
+    uint32_t frequency = 700;
+    Quirks quirks = default_quirks;
+    uint64_t ticks = 0; // timer ticks up to and including the one it halted in
+    uint64_t instructions = 0;
+
+    uint16_t pc = 0;
+    uint16_t I_reg = 0;
+    std::array<uint8_t, 16> VX_reg{};
+    uint64_t frame_hash = 0;
+    uint64_t memory_hash = 0;
+};
+
+// Fills the fields that come from the machine, leaving the run alone
+void setExpectedState(ExpectedState& expected, const Chip8State& state);
+
+// FNV-1a over memory
+uint64_t memoryHash(const Chip8State& state);
+
+// header goes first, as lines starting with #
+bool writeExpectedState(const std::string& filename, const std::string& header, const ExpectedState& expected);
+bool readExpectedState(const std::string& filename, ExpectedState& expected);
@@ -0,0 +1,36 @@
+#include "input_script.h"
+
+#include <algorithm>
+#include <cctype>
+#include <fstream>
+#include <sstream>
+
+#include <fmt/core.h>
+
+bool readInputScript(const std::string& filename, std::vector<InputEvent>& events) {
+    std::ifstream file(filename);
+    if (!file.is_open()) {
+        fmt::print("Could not open {}\n", filename);
+        return false;
+    }
+    std::string line;
+    for (int number = 1; std::getline(file, line); number++) {
+        line = line.substr(0, line.find('#'));
+        std::istringstream fields(line);
+        uint64_t frame;
+        std::string key;
+        std::string state;
+        if (!(fields >> frame)) {
+            continue;
+        }
+        if (!(fields >> key >> state) || key.size() != 1 || !std::isxdigit(static_cast<unsigned char>(key[0]))
+            || (state != "down" && state != "up")) {
+            fmt::print("{}:{}: expected <frame> <key 0-F> <down|up>\n", filename, number);
+            return false;
+        }
+        events.push_back({frame, static_cast<uint8_t>(std::stoi(key, nullptr, 16)), state == "down"});
+    }
+    std::stable_sort(events.begin(), events.end(),
+                     [](const InputEvent& a, const InputEvent& b) { return a.frame < b.frame; });
+    return true;
+}
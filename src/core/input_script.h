@@ -0,0 +1,16 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// A key change applied before the given frame runs
+struct InputEvent {
+    uint64_t frame;
+    uint8_t key;
+    bool pressed;
+};
+
+// Reads a script of one event per line, <frame> <key 0-F> <down|up>, where
+// # starts a comment. The events come back ordered by frame.
+bool readInputScript(const std::string& filename, std::vector<InputEvent>& events);
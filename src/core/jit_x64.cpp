@@ -0,0 +1,407 @@
+#include "jit_x64.h"
+#include "chip8.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include <fmt/core.h>
+
+#ifdef CHIP8_JIT_X64
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+namespace {
+    // x86-64 register numbers as used in the ModRM reg field
+    constexpr uint8_t eax = 0;
+    constexpr uint8_t ecx = 1;
+    constexpr uint8_t edx = 2;
+
+    constexpr uint8_t cmove = 0x44;
+    constexpr uint8_t cmovne = 0x45;
+
+    // Upper bound of the bytes emitted for one instruction, including its budget and stop checks
+    constexpr std::size_t max_instruction_bytes = 96;
+} // Anonymous namespace
+
+JitX64::JitX64(const Chip8& chip) {
+    const auto base = reinterpret_cast<const char*>(&chip);
+    pc_offset = static_cast<int32_t>(reinterpret_cast<const char*>(&chip.pc) - base);
+    I_offset = static_cast<int32_t>(reinterpret_cast<const char*>(&chip.I_reg) - base);
+    VX_offset = static_cast<int32_t>(reinterpret_cast<const char*>(&chip.VX_reg[0]) - base);
+    delay_offset = static_cast<int32_t>(reinterpret_cast<const char*>(&chip.delay_timer) - base);
+    sound_offset = static_cast<int32_t>(reinterpret_cast<const char*>(&chip.sound_timer) - base);
+
+    mapCode();
+    cursor = writable_code;
+}
+
+JitX64::~JitX64() {
+    releaseCode();
+}
+
+// The cache is never writable and executable at once. On Linux the same
+// memory is mapped twice, once writable to emit into and once executable.
+// Elsewhere it is mapped once and compile switches the pages it emits into.
+void JitX64::mapCode() {
+#if defined(CHIP8_JIT_X64) && defined(__linux__)
+    const int fd = memfd_create("pof-jit", MFD_CLOEXEC);
+    if (fd >= 0 && ftruncate(fd, code_size) == 0) {
+        void* writable = mmap(nullptr, code_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        void* executable = mmap(nullptr, code_size, PROT_READ | PROT_EXEC, MAP_SHARED, fd, 0);
+        if (writable != MAP_FAILED && executable != MAP_FAILED) {
+            writable_code = static_cast<uint8_t*>(writable);
+            code = static_cast<uint8_t*>(executable);
+        }
+        else {
+            if (writable != MAP_FAILED) {
+                munmap(writable, code_size);
+            }
+            if (executable != MAP_FAILED) {
+                munmap(executable, code_size);
+            }
+        }
+    }
+    if (fd >= 0) {
+        close(fd);
+    }
+#elif defined(CHIP8_JIT_X64)
+    void* memory = mmap(nullptr, code_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (memory != MAP_FAILED) {
+        code = static_cast<uint8_t*>(memory);
+        writable_code = code;
+        if (!protect(code, code_size, false)) {
+            munmap(memory, code_size);
+            code = nullptr;
+            writable_code = nullptr;
+        }
+    }
+#endif
+    if (isSupported() && code == nullptr) {
+        // hardened kernels may refuse executable memory to the process
+        fmt::print("JIT could not get executable memory, interpreting instead\n");
+    }
+}
+
+// Switches the pages of a single mapping covering [begin, begin + length)
+// between writable and executable, a dual mapping needs nothing
+bool JitX64::protect(uint8_t* begin, std::size_t length, bool writable) {
+#ifdef CHIP8_JIT_X64
+    if (code != writable_code) {
+        return true;
+    }
+    const std::size_t page_size = static_cast<std::size_t>(sysconf(_SC_PAGESIZE));
+    const std::size_t first = static_cast<std::size_t>(begin - code) / page_size * page_size;
+    const std::size_t last = std::min(static_cast<std::size_t>(begin - code) + length, code_size);
+    return mprotect(code + first, last - first, writable ? PROT_READ | PROT_WRITE : PROT_READ | PROT_EXEC) == 0;
+#else
+    (void)begin;
+    (void)length;
+    (void)writable;
+    return false;
+#endif
+}
+
+void JitX64::releaseCode() {
+#ifdef CHIP8_JIT_X64
+    if (writable_code != nullptr && writable_code != code) {
+        munmap(writable_code, code_size);
+    }
+    if (code != nullptr) {
+        munmap(code, code_size);
+    }
+#endif
+    code = nullptr;
+    writable_code = nullptr;
+    cursor = nullptr;
+    blocks.fill(Block{});
+    translated.reset();
+}
+
+bool JitX64::isSupported() {
+#ifdef CHIP8_JIT_X64
+    return true;
+#else
+    return false;
+#endif
+}
+
+uint32_t JitX64::run(Chip8& chip, uint32_t cycles) {
+    uint32_t remaining = cycles;
+    while(remaining > 0 && !chip.stop_requested) {
+        // breakpoints are left to the interpreter, which knows when to stop at them
+        if(code == nullptr || chip.pc >= 4096 || chip.breakpoints[chip.pc]) {
+            remaining -= chip.fetchDecodeExecute();
+            continue;
+        }
+
+        Block* block = &blocks[chip.pc];
+        if(block->code == nullptr) {
+            block = &compile(chip, chip.pc);
+            if(block->code == nullptr) {
+                continue;
+            }
+        }
+        const uint32_t executed = block->code(&chip, remaining);
+        // a trap ends the block in the instruction that raised it, which did not retire
+        const bool trapped = !chip.is_running && chip.exit_reason != ExitReason::Shutdown;
+        remaining -= executed - trapped;
+    }
+    return cycles - remaining;
+}
+
+void JitX64::invalidate(uint16_t address, uint16_t length) {
+    const int last = std::min<int>(address + length, 4096);
+    for(int i = address; i < last; i++) {
+        if(!translated[i]) {
+            continue;
+        }
+        // any block starting up to one maximal block before may cover this byte
+        const int first_start = std::max(i - 2*max_block_length + 1, 0);
+        for(int start = first_start; start <= i; start++) {
+            if(blocks[start].code != nullptr && blocks[start].end > i) {
+                blocks[start] = Block{};
+            }
+        }
+    }
+}
+
+void JitX64::flush() {
+    blocks.fill(Block{});
+    translated.reset();
+    cursor = writable_code;
+}
+
+JitX64::Block& JitX64::compile(const Chip8& chip, uint16_t start) {
+    const std::size_t max_block_bytes = max_instruction_bytes * (max_block_length + 1);
+    if(static_cast<std::size_t>(writable_code + code_size - cursor) < max_block_bytes) {
+        flush();
+    }
+
+    uint8_t* const block_start = cursor;
+    if(!protect(block_start, max_block_bytes, true)) {
+        fmt::print("JIT could not write to its code cache, interpreting instead\n");
+        releaseCode();
+        return blocks[start];
+    }
+    Block& block = blocks[start];
+
+    // uint32_t block(Chip8* chip, uint32_t budget), returns the instructions executed
+    emit8(0x53);                                     // push rbx
+    emit8(0x41); emit8(0x54);                        // push r12
+    emit8(0x48); emit8(0x83); emit8(0xEC); emit8(8); // sub rsp, 8
+    emit8(0x48); emit8(0x89); emit8(0xFB);           // mov rbx, rdi
+    emit8(0x41); emit8(0x89); emit8(0xF4);           // mov r12d, esi
+
+    const auto emitReturn = [this](uint8_t executed) {
+        emit8(0xB8); emit32(executed);                   // mov eax, executed
+        emit8(0x48); emit8(0x83); emit8(0xC4); emit8(8); // add rsp, 8
+        emit8(0x41); emit8(0x5C);                        // pop r12
+        emit8(0x5B);                                     // pop rbx
+        emit8(0xC3);                                     // ret
+    };
+
+    uint32_t address = start;
+    uint8_t length = 0;
+    bool ended = false;
+    while(!ended && length < max_block_length && address < 4096 && !(length > 0 && chip.breakpoints[address])) {
+        if(length > 0) {
+            // stop here when the budget is spent
+            emit8(0x41); emit8(0x83); emit8(0xFC); emit8(length); // cmp r12d, length
+            emit8(0x77); emit8(22);                               // ja over the exit
+            emitStorePc(address);
+            emitReturn(length);
+        }
+
+        const DecodedInstruction insty = decode(Instruction(chip.emulated_memory[address], chip.emulated_memory[(address+1) & 0xFFF]));
+        const uint16_t next = address + 2;
+        length++;
+
+        switch(insty.op) {
+            case Op::SetImm: // mov byte [VX], NN
+                emit8(0xC6); emitModRM(0, VX_offset + insty.x); emit8(insty.nn);
+                break;
+            case Op::AddImm: // add byte [VX], NN
+                emit8(0x80); emitModRM(0, VX_offset + insty.x); emit8(insty.nn);
+                break;
+            case Op::SetReg:
+                emit8(0x8A); emitModRM(eax, VX_offset + insty.y); // mov al, [VY]
+                emit8(0x88); emitModRM(eax, VX_offset + insty.x); // mov [VX], al
+                break;
+            case Op::Or:
+            case Op::And:
+            case Op::Xor:
+                emit8(0x8A); emitModRM(eax, VX_offset + insty.y); // mov al, [VY]
+                emit8(insty.op == Op::Or ? 0x08 : insty.op == Op::And ? 0x20 : 0x30);
+                emitModRM(eax, VX_offset + insty.x);              // op [VX], al
+                break;
+            case Op::AddReg:
+                emit8(0x0F); emit8(0xB6); emitModRM(eax, VX_offset + insty.x); // movzx eax, byte [VX]
+                emit8(0x0F); emit8(0xB6); emitModRM(ecx, VX_offset + insty.y); // movzx ecx, byte [VY]
+                emit8(0x01); emit8(0xC8);                                      // add eax, ecx
+                emit8(0x89); emit8(0xC2);                                      // mov edx, eax
+                emit8(0xC1); emit8(0xEA); emit8(8);                            // shr edx, 8
+                emit8(0x88); emitModRM(edx, VX_offset + 0xF);                  // mov [VF], dl
+                emit8(0x88); emitModRM(eax, VX_offset + insty.x);              // mov [VX], al
+                break;
+            case Op::SubReg:
+            case Op::SubnReg:
+                emit8(0x0F); emit8(0xB6); emitModRM(eax, VX_offset + insty.x); // movzx eax, byte [VX]
+                emit8(0x0F); emit8(0xB6); emitModRM(ecx, VX_offset + insty.y); // movzx ecx, byte [VY]
+                if(insty.op == Op::SubReg) {
+                    emit8(0x89); emit8(0xC2);                                  // mov edx, eax
+                    emit8(0x29); emit8(0xCA);                                  // sub edx, ecx
+                    emit8(0x88); emitModRM(edx, VX_offset + insty.x);          // mov [VX], dl
+                    emit8(0x39); emit8(0xC8);                                  // cmp eax, ecx
+                }
+                else {
+                    emit8(0x89); emit8(0xCA);                                  // mov edx, ecx
+                    emit8(0x29); emit8(0xC2);                                  // sub edx, eax
+                    emit8(0x88); emitModRM(edx, VX_offset + insty.x);          // mov [VX], dl
+                    emit8(0x39); emit8(0xC1);                                  // cmp ecx, eax
+                }
+                emit8(0x0F); emit8(0x93); emit8(0xC2);                         // setae dl
+                emit8(0x88); emitModRM(edx, VX_offset + 0xF);                  // mov [VF], dl
+                break;
+            case Op::SetIndex: // mov word [I], NNN
+                emit8(0x66); emit8(0xC7); emitModRM(0, I_offset); emit16(insty.nnn);
+                break;
+            case Op::AddIndex:
+                emit8(0x0F); emit8(0xB6); emitModRM(eax, VX_offset + insty.x); // movzx eax, byte [VX]
+                emit8(0x66); emit8(0x01); emitModRM(eax, I_offset);            // add [I], ax
+                break;
+            case Op::GetDelay:
+                emit8(0x8A); emitModRM(eax, delay_offset);        // mov al, [delay]
+                emit8(0x88); emitModRM(eax, VX_offset + insty.x); // mov [VX], al
+                break;
+            case Op::SetDelay:
+                emit8(0x8A); emitModRM(eax, VX_offset + insty.x); // mov al, [VX]
+                emit8(0x88); emitModRM(eax, delay_offset);        // mov [delay], al
+                break;
+            case Op::Jump:
+                if(insty.nnn == address) {
+                    // a jump to itself goes through the handler, which reports the halt
+                    emitStorePc(next);
+                    emitCallHandler(insty);
+                }
+                else {
+                    emitStorePc(insty.nnn);
+                }
+                ended = true;
+                break;
+            case Op::SkipEqualImm:
+            case Op::SkipNotEqualImm:
+                emit8(0x80); emitModRM(7, VX_offset + insty.x); emit8(insty.nn); // cmp byte [VX], NN
+                emitSkip(next, insty.op == Op::SkipEqualImm ? cmove : cmovne);
+                ended = true;
+                break;
+            case Op::SkipEqualReg:
+            case Op::SkipNotEqualReg:
+                emit8(0x8A); emitModRM(edx, VX_offset + insty.x); // mov dl, [VX]
+                emit8(0x3A); emitModRM(edx, VX_offset + insty.y); // cmp dl, [VY]
+                emitSkip(next, insty.op == Op::SkipEqualReg ? cmove : cmovne);
+                ended = true;
+                break;
+            default:
+                emitStorePc(next);
+                emitCallHandler(insty);
+                switch(insty.op) {
+                    case Op::Return:
+                    case Op::Call:
+                    case Op::JumpOffset:
+                    case Op::SkipKey:
+                    case Op::SkipNotKey:
+                    case Op::WaitKey:
+                    // these may rewrite the code that follows
+                    case Op::Bcd:
+                    case Op::Store:
+                        ended = true;
+                        break;
+                    default:
+                        // the handler returned whether to stop, pc already points past it
+                        emit8(0x84); emit8(0xC0); // test al, al
+                        emit8(0x74); emit8(13);   // jz over the exit
+                        emitReturn(length);
+                        break;
+                }
+                break;
+        }
+
+        address = next;
+    }
+
+    if(!ended) {
+        emitStorePc(address);
+    }
+    emitReturn(length);
+
+    if(!protect(block_start, max_block_bytes, false)) {
+        fmt::print("JIT could not get executable memory, interpreting instead\n");
+        releaseCode();
+        return blocks[start];
+    }
+    // the block runs from the executable view of the bytes just emitted
+    block.code = reinterpret_cast<BlockFn>(code + (block_start - writable_code));
+    block.end = std::min<uint32_t>(address, 4096);
+    block.length = length;
+    for(uint32_t i = start; i < block.end; i++) {
+        translated.set(i);
+    }
+    return block;
+}
+
+void JitX64::emit8(uint8_t byte) {
+    *cursor++ = byte;
+}
+
+void JitX64::emit16(uint16_t value) {
+    std::memcpy(cursor, &value, sizeof(value));
+    cursor += sizeof(value);
+}
+
+void JitX64::emit32(uint32_t value) {
+    std::memcpy(cursor, &value, sizeof(value));
+    cursor += sizeof(value);
+}
+
+void JitX64::emit64(uint64_t value) {
+    std::memcpy(cursor, &value, sizeof(value));
+    cursor += sizeof(value);
+}
+
+void JitX64::emitModRM(uint8_t reg, int32_t offset) {
+    // [rbx + disp32]
+    emit8(0x80 | (reg << 3) | 0x3);
+    emit32(static_cast<uint32_t>(offset));
+}
+
+void JitX64::emitStorePc(uint16_t value) {
+    // mov word [pc], value
+    emit8(0x66); emit8(0xC7); emitModRM(0, pc_offset); emit16(value);
+}
+
+void JitX64::emitSkip(uint16_t address, uint8_t cmov) {
+    // pc = flags ? address + 2 : address, the movs leave the flags alone
+    emit8(0xB8); emit32(address);                   // mov eax, address
+    emit8(0xB9); emit32(address + 2);               // mov ecx, address + 2
+    emit8(0x0F); emit8(cmov); emit8(0xC1);          // cmovcc eax, ecx
+    emit8(0x66); emit8(0x89); emitModRM(eax, pc_offset); // mov [pc], ax
+}
+
+void JitX64::emitCallHandler(DecodedInstruction insty) {
+    uint64_t packed = 0;
+    static_assert(sizeof(insty) <= sizeof(packed));
+    std::memcpy(&packed, &insty, sizeof(insty));
+
+    emit8(0x48); emit8(0x89); emit8(0xDF); // mov rdi, rbx
+    emit8(0x48); emit8(0xBE); emit64(packed); // mov rsi, packed
+    emit8(0x48); emit8(0xB8); emit64(reinterpret_cast<uint64_t>(&JitX64::executeHandler)); // mov rax, handler
+    emit8(0xFF); emit8(0xD0); // call rax
+}
+
+bool JitX64::executeHandler(Chip8* chip, uint64_t packed) {
+    DecodedInstruction insty;
+    std::memcpy(static_cast<void*>(&insty), &packed, sizeof(insty));
+    chip->executeDecoded(insty);
+    return chip->stop_requested;
+}
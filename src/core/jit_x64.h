@@ -0,0 +1,81 @@
+#pragma once
+
+#include <array>
+#include <bitset>
+#include <cstddef>
+#include <cstdint>
+
+#include "decoder.h"
+
+#if defined(__x86_64__) && !defined(_WIN32)
+#define CHIP8_JIT_X64
+#endif
+
+class Chip8;
+
+// Translates straight-line runs of CHIP-8 instructions into x86-64 code.
+// Simple ALU, index, timer and branch instructions are emitted inline,
+// everything else calls back into the interpreter handlers.
+class JitX64 {
+    public:
+    explicit JitX64(const Chip8& chip);
+    ~JitX64();
+
+    JitX64(const JitX64&) = delete;
+    JitX64& operator=(const JitX64&) = delete;
+
+    static bool isSupported();
+
+    // returns the instructions retired
+    uint32_t run(Chip8& chip, uint32_t cycles);
+    void invalidate(uint16_t address, uint16_t length);
+
+    private:
+    // returns the instructions executed, at most budget
+    using BlockFn = uint32_t (*)(Chip8* chip, uint32_t budget);
+
+    struct Block {
+        BlockFn code = nullptr;
+        uint16_t end = 0; // one past the last byte translated
+        uint8_t length = 0; // in instructions
+    };
+
+    static constexpr int max_block_length = 32;
+    static constexpr std::size_t code_size = 1 << 20;
+
+    // leaves the block empty, and the JIT off, when it cannot get executable memory
+    Block& compile(const Chip8& chip, uint16_t start);
+    void flush();
+    void mapCode();
+    // returns whether the pages could be switched
+    bool protect(uint8_t* begin, std::size_t length, bool writable);
+    // leaves everything to the interpreter from here on
+    void releaseCode();
+
+    // x86-64 emitters, memory operands are relative to the Chip8 in rbx
+    void emit8(uint8_t byte);
+    void emit16(uint16_t value);
+    void emit32(uint32_t value);
+    void emit64(uint64_t value);
+    void emitModRM(uint8_t reg, int32_t offset);
+    void emitStorePc(uint16_t value);
+    void emitSkip(uint16_t address, uint8_t cmov);
+    void emitCallHandler(DecodedInstruction insty);
+
+    // returns whether the run has to stop
+    static bool executeHandler(Chip8* chip, uint64_t packed);
+
+    std::array<Block, 4096> blocks{};
+    std::bitset<4096> translated; // bytes covered by a block since the last flush
+
+    uint8_t* code = nullptr; // executable
+    uint8_t* writable_code = nullptr; // the same memory where compile emits, code itself without a second mapping
+    uint8_t* cursor = nullptr; // in writable_code
+
+    // offsets of the Chip8 registers the generated code accesses directly
+    int32_t pc_offset = 0;
+    int32_t I_offset = 0;
+    int32_t VX_offset = 0;
+    int32_t delay_offset = 0;
+    int32_t sound_offset = 0;
+};
@@ -1,9 +1,12 @@
+#include <algorithm>
 #include <fstream>
+#include <vector>
 #include <fmt/core.h>
 
 #include "loader.h"
 
-void loadChip8Program(Chip8& chip, std::string filename) {
+std::vector<uint8_t> readChip8Program(const std::string& filename) {
+    std::vector<uint8_t> program;
     std::ifstream file(filename, std::ios::in | std::ios::binary);
     if (file.is_open()) {
         // get length of file:
@@ -13,13 +16,15 @@ void loadChip8Program(Chip8& chip, std::string filename) {
 
         if (length < 4096 - 512) {
             fmt::print("Reading {} bytes...\n", length);
-            file.read((char*) &chip.emulated_memory[512], length);
+            program.resize(length);
+            file.read((char*) program.data(), length);
 
             if (file) {
                 fmt::print("all characters read successfully.\n");
             }
             else {
                 fmt::print("error: only {} could be read.\n", file.gcount());
+                program.resize(file.gcount());
             }
         }
         else {
@@ -28,4 +33,13 @@ void loadChip8Program(Chip8& chip, std::string filename) {
 
         file.close();
     }
+    return program;
+}
+
+void loadChip8Program(Chip8& chip, std::string filename) {
+    chip.loadProgram(readChip8Program(filename));
+}
+
+void loadChip8Program(Chip8Batch& batch, std::string filename) {
+    batch.loadProgram(readChip8Program(filename));
 }
@@ -1,6 +1,13 @@
 #pragma once
 
+#include <cstdint>
 #include <string>
+#include <vector>
+#include "batch.h"
 #include "chip8.h"
 
+// Reads a program to be loaded at 0x200, empty if there is none
+std::vector<uint8_t> readChip8Program(const std::string& filename);
+
 void loadChip8Program(Chip8& chip, std::string filename);
+void loadChip8Program(Chip8Batch& batch, std::string filename);
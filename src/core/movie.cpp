@@ -0,0 +1,105 @@
+#include "movie.h"
+
+#include <cctype>
+#include <charconv>
+#include <fstream>
+#include <sstream>
+
+#include <fmt/format.h>
+
+uint64_t romHash(const std::vector<uint8_t>& program) {
+    uint64_t hash = 0xCBF29CE484222325u;
+    for(const uint8_t byte : program) {
+        hash = (hash ^ byte) * 0x100000001B3u;
+    }
+    return hash;
+}
+
+bool writeMovie(const std::string& filename, const Movie& movie) {
+    std::ofstream file(filename);
+    file << "# pof movie\n";
+    file << fmt::format("rom {:016x}\nseed {}\nfrequency {}\nquirks {}\nlength {}\n",
+                        movie.rom_hash, movie.seed, movie.frequency, movie.quirks, movie.length);
+    for(const MovieEvent& event : movie.events) {
+        file << fmt::format("{} {:X} {}\n", event.cycle, event.key, event.pressed ? "down" : "up");
+    }
+    if(!file) {
+        fmt::print("Could not write {}\n", filename);
+        return false;
+    }
+    return true;
+}
+
+bool readMovie(const std::string& filename, Movie& movie) {
+    std::ifstream file(filename);
+    if(!file.is_open()) {
+        fmt::print("Could not open {}\n", filename);
+        return false;
+    }
+    std::string line;
+    for(int number = 1; std::getline(file, line); number++) {
+        std::istringstream fields(line.substr(0, line.find('#')));
+        std::string first;
+        if(!(fields >> first)) {
+            continue;
+        }
+        bool valid = true;
+        if(first == "rom") {
+            valid = static_cast<bool>(fields >> std::hex >> movie.rom_hash);
+        }
+        else if(first == "seed") {
+            valid = static_cast<bool>(fields >> movie.seed);
+        }
+        else if(first == "frequency") {
+            valid = static_cast<bool>(fields >> movie.frequency);
+        }
+        else if(first == "length") {
+            valid = static_cast<bool>(fields >> movie.length);
+        }
+        else if(first == "quirks") {
+            unsigned quirks;
+            valid = static_cast<bool>(fields >> quirks) && quirks < quirk_combinations;
+            movie.quirks = static_cast<Quirks>(quirks);
+        }
+        else {
+            std::string key;
+            std::string state;
+            valid = std::isdigit(static_cast<unsigned char>(first[0])) && (fields >> key >> state)
+                && key.size() == 1 && std::isxdigit(static_cast<unsigned char>(key[0]))
+                && (state == "down" || state == "up");
+            uint64_t cycle = 0;
+            uint8_t value = 0;
+            // a cycle that is not all digits or does not fit makes a bad line like any other
+            const auto parsed = std::from_chars(first.data(), first.data() + first.size(), cycle);
+            valid = valid && parsed.ec == std::errc() && parsed.ptr == first.data() + first.size()
+                && std::from_chars(key.data(), key.data() + key.size(), value, 16).ec == std::errc()
+                && (movie.events.empty() || movie.events.back().cycle <= cycle);
+            if(valid) {
+                movie.events.push_back({cycle, value, state == "down"});
+            }
+        }
+        if(!valid) {
+            fmt::print("{}:{}: not a movie line\n", filename, number);
+            return false;
+        }
+    }
+    return true;
+}
+
+void setUpForMovie(Chip8& chip, const Movie& movie) {
+    chip.setSeed(movie.seed);
+    chip.setCoreFrequency(movie.frequency);
+    chip.setQuirks(movie.quirks);
+}
+
+MoviePlayer::MoviePlayer(const Movie& movie) : movie(movie) {}
+
+void MoviePlayer::apply(Chip8& chip) {
+    for(; next_event < movie.events.size() && movie.events[next_event].cycle <= chip.cycles(); next_event++) {
+        chip.setKey(movie.events[next_event].key, movie.events[next_event].pressed);
+    }
+}
+
+bool MoviePlayer::finished() const {
+    return next_event == movie.events.size();
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "chip8.h"
+
+// A key change, stamped with the emulated cycle it was applied at
+struct MovieEvent {
+    uint64_t cycle;
+    uint8_t key;
+    bool pressed;
+};
+
+// A recorded session: everything a run depends on besides the ROM, and a
+// hash to check the ROM by. Played back on a machine set up the same way,
+// it reproduces the session exactly, at any speed.
+struct Movie {
+    uint64_t rom_hash = 0;
+    uint32_t seed = 0;
+    uint32_t frequency = 700;
+    Quirks quirks = default_quirks;
+    uint64_t length = 0; // cycles the session ran for
+    std::vector<MovieEvent> events; // ordered by cycle
+};
+
+// FNV-1a of a program
+uint64_t romHash(const std::vector<uint8_t>& program);
+
+// Movies are text: a line per setting followed by a line per event,
+// <cycle> <key 0-F> <down|up>
+bool writeMovie(const std::string& filename, const Movie& movie);
+bool readMovie(const std::string& filename, Movie& movie);
+
+// Seeds, clocks and configures a machine as the movie was recorded on
+void setUpForMovie(Chip8& chip, const Movie& movie);
+
+// Applies the key changes of a movie as emulated time reaches them
+class MoviePlayer {
+    public:
+    explicit MoviePlayer(const Movie& movie);
+
+    // applies every event up to the current cycle of chip
+    void apply(Chip8& chip);
+    bool finished() const;
+
+    private:
+    const Movie& movie;
+    std::size_t next_event = 0;
+};
@@ -0,0 +1,24 @@
+#include "pacer.h"
+#include "clock.h"
+
+FramePacer::FramePacer(Clock& clock) : clock(clock), start(clock.now()) {}
+
+void FramePacer::waitForNextTick() {
+    using namespace std::chrono;
+    using TickDuration = duration<int64_t, std::ratio<1, CycleClock::timer_frequency>>;
+    const auto deadlineOf = [this](uint64_t tick) {
+        return start + duration_cast<nanoseconds>(TickDuration(tick));
+    };
+
+    ticks++;
+    if(clock.now() > deadlineOf(ticks + max_lag_ticks)) {
+        reset();
+        return;
+    }
+    clock.sleepUntil(deadlineOf(ticks));
+}
+
+void FramePacer::reset() {
+    start = clock.now();
+    ticks = 0;
+}
@@ -0,0 +1,27 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+
+class Clock;
+
+// Keeps emulated time in step with host time. Each timer tick has an
+// absolute deadline counted from the start, so a late wake-up is made up
+// by the next sleep instead of adding up to drift.
+class FramePacer {
+    public:
+    explicit FramePacer(Clock& clock);
+
+    // sleeps until the end of the tick that was just emulated
+    void waitForNextTick();
+    // counts from now on, after a pause or when too far behind to catch up
+    void reset();
+
+    private:
+    // further behind than this, the lost time is dropped instead of run at full speed
+    static constexpr uint64_t max_lag_ticks = 6;
+
+    Clock& clock;
+    std::chrono::nanoseconds start;
+    uint64_t ticks = 0;
+};
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <cstdint>
+#include <limits>
+
+// PCG32 (XSH RR), the generator behind CXNN. Its whole state is two words
+// and it is trivially copyable, so it lives in the machine snapshot and a
+// restored machine draws the same numbers again. A number costs a
+// multiply, an add and a rotate. Generators seeded alike but on different
+// streams give independent sequences.
+class Pcg32 {
+    public:
+    using result_type = uint32_t;
+
+    constexpr explicit Pcg32(uint64_t seed = 0, uint64_t stream = 0) {
+        this->seed(seed, stream);
+    }
+
+    constexpr void seed(uint64_t seed, uint64_t stream = 0) {
+        increment = stream << 1 | 1;
+        state = 0;
+        (*this)();
+        state += seed;
+        (*this)();
+    }
+
+    constexpr result_type operator()() {
+        const uint64_t old = state;
+        state = old * 6364136223846793005u + increment;
+        const uint32_t xorshifted = static_cast<uint32_t>(((old >> 18) ^ old) >> 27);
+        const uint32_t rotation = static_cast<uint32_t>(old >> 59);
+        return xorshifted >> rotation | xorshifted << ((32 - rotation) & 31);
+    }
+
+    static constexpr result_type min() {
+        return 0;
+    }
+    static constexpr result_type max() {
+        return std::numeric_limits<result_type>::max();
+    }
+
+    friend constexpr bool operator==(const Pcg32& a, const Pcg32& b) {
+        return a.state == b.state && a.increment == b.increment;
+    }
+    friend constexpr bool operator!=(const Pcg32& a, const Pcg32& b) {
+        return !(a == b);
+    }
+
+    private:
+    uint64_t state = 0;
+    uint64_t increment = 1;
+};
@@ -0,0 +1,232 @@
+#include "reference.h"
+#include "font.h"
+
+ReferenceChip8::ReferenceChip8(const Chip8State& state, Quirks quirks) : s(state), quirks(quirks) {}
+
+const Chip8State& ReferenceChip8::state() const {
+    return s;
+}
+
+ExitReason ReferenceChip8::exitReason() const {
+    return exit_reason;
+}
+
+uint8_t& ReferenceChip8::memory(uint32_t address) {
+    return s.emulated_memory[address % s.emulated_memory.size()];
+}
+
+void ReferenceChip8::setKey(uint8_t n, bool state) {
+    if(n <= 0xF) {
+        s.key[n] = state;
+    }
+}
+
+void ReferenceChip8::tickTimers() {
+    if(s.delay_timer > 0) {
+        s.delay_timer--;
+    }
+    if(s.sound_timer > 0) {
+        s.sound_timer--;
+    }
+}
+
+bool ReferenceChip8::step() {
+    if(exit_reason != ExitReason::None) {
+        return false;
+    }
+    if(s.pc >= s.emulated_memory.size()) {
+        exit_reason = ExitReason::Error;
+        return false;
+    }
+
+    const Instruction insty(memory(s.pc), memory(s.pc + 1));
+    s.pc += 2;
+
+    const uint8_t x = insty.getSecondNibble();
+    const uint8_t y = insty.getThirdNibble();
+    const uint8_t n = insty.getFourthNibble();
+    const uint8_t nn = insty.getSecondByte();
+    const uint16_t nnn = insty.getLastThreeNibbles();
+    uint8_t* const V = s.VX_reg;
+
+    switch(insty.getFirstNibble()) {
+        case 0x0:
+            if(insty.whole == 0x00E0) {
+                s.framebuffer.fill(0);
+            }
+            else if(insty.whole == 0x00EE) {
+                if(s.stack_size == 0) {
+                    s.pc -= 2;
+                    exit_reason = ExitReason::StackUnderflow;
+                    return false;
+                }
+                s.stack_size--;
+                s.pc = s.stack[s.stack_size];
+            }
+            break;
+        case 0x1:
+            s.pc = nnn;
+            break;
+        case 0x2:
+            if(s.stack_size == s.stack.size()) {
+                s.pc -= 2;
+                exit_reason = ExitReason::StackOverflow;
+                return false;
+            }
+            s.stack[s.stack_size] = s.pc;
+            s.stack_size++;
+            s.pc = nnn;
+            break;
+        case 0x3:
+            if(V[x] == nn) {
+                s.pc += 2;
+            }
+            break;
+        case 0x4:
+            if(V[x] != nn) {
+                s.pc += 2;
+            }
+            break;
+        case 0x5:
+            if(V[x] == V[y]) {
+                s.pc += 2;
+            }
+            break;
+        case 0x6:
+            V[x] = nn;
+            break;
+        case 0x7:
+            V[x] += nn;
+            break;
+        case 0x8: {
+            const uint8_t vx = V[x];
+            const uint8_t vy = V[y];
+            switch(n) {
+                case 0x0:
+                    V[x] = vy;
+                    break;
+                case 0x1:
+                    V[x] = vx | vy;
+                    break;
+                case 0x2:
+                    V[x] = vx & vy;
+                    break;
+                case 0x3:
+                    V[x] = vx ^ vy;
+                    break;
+                case 0x4:
+                    V[0xF] = vx + vy > 255;
+                    V[x] = vx + vy;
+                    break;
+                case 0x5:
+                    V[x] = vx - vy;
+                    V[0xF] = vx >= vy;
+                    break;
+                case 0x7:
+                    V[x] = vy - vx;
+                    V[0xF] = vy >= vx;
+                    break;
+                case 0x6:
+                case 0xE:
+                    if(!(quirks & quirk_new_shift)) {
+                        V[x] = vy;
+                    }
+                    V[0xF] = n == 0x6 ? V[x] & 1 : V[x] >> 7;
+                    V[x] = n == 0x6 ? V[x] >> 1 : V[x] << 1;
+                    break;
+            }
+            break;
+        }
+        case 0x9:
+            if(V[x] != V[y]) {
+                s.pc += 2;
+            }
+            break;
+        case 0xA:
+            s.I_reg = nnn;
+            break;
+        case 0xB:
+            s.pc = nnn + V[quirks & quirk_quirky_jump ? x : 0];
+            break;
+        case 0xC:
+            V[x] = s.randy() & nn;
+            break;
+        case 0xD: {
+            const unsigned left = V[x] % nWidth;
+            const unsigned top = V[y] % nHeight;
+            bool unset = false;
+            for(unsigned row = 0; row < n && top + row < nHeight; row++) {
+                const uint8_t sprite = memory(s.I_reg + row);
+                for(unsigned column = 0; column < 8 && left + column < nWidth; column++) {
+                    if(sprite & (0x80 >> column)) {
+                        const uint64_t pixel = uint64_t{1} << (63 - left - column);
+                        unset |= (s.framebuffer[top + row] & pixel) != 0;
+                        s.framebuffer[top + row] ^= pixel;
+                    }
+                }
+            }
+            V[0xF] = unset;
+            break;
+        }
+        case 0xE:
+            if(nn == 0x9E && V[x] < 16 && s.key[V[x]]) {
+                s.pc += 2;
+            }
+            else if(nn == 0xA1 && (V[x] >= 16 || !s.key[V[x]])) {
+                s.pc += 2;
+            }
+            break;
+        case 0xF:
+            switch(nn) {
+                case 0x07:
+                    V[x] = s.delay_timer;
+                    break;
+                case 0x0A: {
+                    int pressed = 0;
+                    while(pressed < 16 && !s.key[pressed]) {
+                        pressed++;
+                    }
+                    if(pressed < 16) {
+                        V[x] = pressed;
+                    }
+                    else {
+                        s.pc -= 2;
+                    }
+                    break;
+                }
+                case 0x15:
+                    s.delay_timer = V[x];
+                    break;
+                case 0x18:
+                    s.sound_timer = V[x];
+                    break;
+                case 0x1E:
+                    s.I_reg += V[x];
+                    break;
+                case 0x29:
+                    s.I_reg = font_starting_address + 5*(V[x] & 0xF);
+                    break;
+                case 0x33:
+                    memory(s.I_reg) = V[x] / 100;
+                    memory(s.I_reg + 1) = V[x] / 10 % 10;
+                    memory(s.I_reg + 2) = V[x] % 10;
+                    break;
+                case 0x55:
+                case 0x65:
+                    for(int i = 0; i <= x; i++) {
+                        if(nn == 0x55) {
+                            memory(s.I_reg + i) = V[i];
+                        }
+                        else {
+                            V[i] = memory(s.I_reg + i);
+                        }
+                    }
+                    if(quirks & quirk_load_store) {
+                        s.I_reg += x;
+                    }
+                    break;
+            }
+            break;
+    }
+    return true;
+}
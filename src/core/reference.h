@@ -0,0 +1,32 @@
+#pragma once
+
+#include <cstdint>
+
+#include "chip8.h"
+
+// A plain interpreter of the same machine: every instruction is fetched and
+// decoded from memory with one switch over the opcode, with no decode cache,
+// superinstructions or idle loop skipping. It is slow on purpose and serves
+// as the reference the faster backends are checked against.
+//
+// Where VF is also the destination, it ends up holding whatever the core
+// writes last.
+class ReferenceChip8 {
+    public:
+    ReferenceChip8(const Chip8State& state, Quirks quirks);
+
+    // Runs one instruction, returns false once the machine stopped
+    bool step();
+    void tickTimers();
+    void setKey(uint8_t n, bool state);
+
+    const Chip8State& state() const;
+    ExitReason exitReason() const;
+
+    private:
+    uint8_t& memory(uint32_t address);
+
+    Chip8State s;
+    Quirks quirks;
+    ExitReason exit_reason = ExitReason::None;
+};
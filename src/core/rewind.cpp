@@ -0,0 +1,162 @@
+#include "rewind.h"
+
+#include <algorithm>
+#include <cstring>
+
+// A record is its encoded length, the encoding and the length again, so
+// the ring can be walked from the oldest end and from the newest. The
+// encoding is a list of runs: a varint count of unchanged bytes, a varint
+// count of changed bytes and the XOR of those changed bytes.
+
+namespace {
+    constexpr std::size_t length_size = sizeof(uint32_t);
+
+    std::size_t putVarint(uint8_t* out, std::size_t value) {
+        std::size_t written = 0;
+        while(value >= 0x80) {
+            out[written++] = static_cast<uint8_t>(value | 0x80);
+            value >>= 7;
+        }
+        out[written++] = static_cast<uint8_t>(value);
+        return written;
+    }
+
+    std::size_t getVarint(const uint8_t* in, std::size_t& value) {
+        std::size_t read = 0;
+        value = 0;
+        for(int shift = 0;; shift += 7) {
+            const uint8_t byte = in[read++];
+            value |= static_cast<std::size_t>(byte & 0x7F) << shift;
+            if(!(byte & 0x80)) {
+                return read;
+            }
+        }
+    }
+} // Anonymous namespace
+
+RewindBuffer::RewindBuffer(std::size_t budget_bytes)
+    : newest(state_size),
+      // runs of changed bytes are at least two bytes apart, and the two
+      // varints of a run take at most three bytes each
+      scratch(state_size + 6 * (state_size / 2 + 1)) {
+    // room for at least one record of a frame that changed everything
+    ring.resize(std::max(budget_bytes, scratch.size() + 2 * length_size));
+}
+
+void RewindBuffer::clear() {
+    oldest = 0;
+    used = 0;
+    records = 0;
+    has_newest = false;
+}
+
+std::size_t RewindBuffer::frames() const {
+    return records;
+}
+
+std::size_t RewindBuffer::bytesUsed() const {
+    return used;
+}
+
+void RewindBuffer::writeRing(std::size_t position, const uint8_t* data, std::size_t length) {
+    position %= ring.size();
+    const std::size_t first = std::min(length, ring.size() - position);
+    std::memcpy(&ring[position], data, first);
+    std::memcpy(&ring[0], data + first, length - first);
+}
+
+void RewindBuffer::readRing(std::size_t position, uint8_t* data, std::size_t length) const {
+    position %= ring.size();
+    const std::size_t first = std::min(length, ring.size() - position);
+    std::memcpy(data, &ring[position], first);
+    std::memcpy(data + first, &ring[0], length - first);
+}
+
+uint32_t RewindBuffer::readLength(std::size_t position) const {
+    uint32_t length;
+    readRing(position, reinterpret_cast<uint8_t*>(&length), length_size);
+    return length;
+}
+
+void RewindBuffer::dropOldest() {
+    const std::size_t record_size = readLength(oldest) + 2 * length_size;
+    oldest = (oldest + record_size) % ring.size();
+    used -= record_size;
+    records--;
+}
+
+std::size_t RewindBuffer::encode(const uint8_t* older, const uint8_t* newer) {
+    std::size_t out = 0;
+    std::size_t i = 0;
+    while(i < state_size) {
+        const std::size_t unchanged_start = i;
+        while(i < state_size && older[i] == newer[i]) {
+            i++;
+        }
+        const std::size_t changed_start = i;
+        // a single unchanged byte costs less inside a run of changes than between two
+        while(i < state_size && (older[i] != newer[i] || (i + 1 < state_size && older[i + 1] != newer[i + 1]))) {
+            i++;
+        }
+        out += putVarint(&scratch[out], changed_start - unchanged_start);
+        out += putVarint(&scratch[out], i - changed_start);
+        for(std::size_t j = changed_start; j < i; j++) {
+            scratch[out++] = older[j] ^ newer[j];
+        }
+    }
+    return out;
+}
+
+void RewindBuffer::decode(std::size_t record_start, uint32_t length, uint8_t* newer) {
+    readRing(record_start, scratch.data(), length);
+    std::size_t in = 0;
+    std::size_t i = 0;
+    while(in < length) {
+        std::size_t unchanged;
+        std::size_t changed;
+        in += getVarint(&scratch[in], unchanged);
+        in += getVarint(&scratch[in], changed);
+        i += unchanged;
+        for(std::size_t j = 0; j < changed; j++) {
+            newer[i++] ^= scratch[in++];
+        }
+    }
+}
+
+void RewindBuffer::push(const Chip8State& state) {
+    const auto* bytes = reinterpret_cast<const uint8_t*>(&state);
+    if(!has_newest) {
+        std::memcpy(newest.data(), bytes, state_size);
+        has_newest = true;
+        return;
+    }
+
+    // the record takes the newest state back to the one before
+    const uint32_t length = static_cast<uint32_t>(encode(newest.data(), bytes));
+    const std::size_t record_size = length + 2 * length_size;
+    while(used + record_size > ring.size()) {
+        dropOldest();
+    }
+    const std::size_t start = oldest + used;
+    writeRing(start, reinterpret_cast<const uint8_t*>(&length), length_size);
+    writeRing(start + length_size, scratch.data(), length);
+    writeRing(start + length_size + length, reinterpret_cast<const uint8_t*>(&length), length_size);
+    used += record_size;
+    records++;
+
+    std::memcpy(newest.data(), bytes, state_size);
+}
+
+bool RewindBuffer::stepBack(Chip8State& state) {
+    if(records == 0) {
+        return false;
+    }
+    const uint32_t length = readLength(oldest + used - length_size);
+    const std::size_t record_size = length + 2 * length_size;
+    decode(oldest + used - record_size + length_size, length, newest.data());
+    used -= record_size;
+    records--;
+
+    std::memcpy(reinterpret_cast<uint8_t*>(&state), newest.data(), state_size);
+    return true;
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "chip8.h"
+
+// The machine states of past frames, newest first, within a memory budget.
+//
+// Only the newest state is kept whole. Every older state is stored as the
+// XOR of its bytes with the state that followed it, which is zero wherever
+// the frame changed nothing, and those zeros are run-length encoded. A
+// frame that touches a few bytes costs a few bytes. The records share one
+// ring of budget bytes: stepping back decodes the newest record onto the
+// newest state, and once the ring is full the oldest records are dropped.
+// Nothing is allocated after construction.
+class RewindBuffer {
+    public:
+    explicit RewindBuffer(std::size_t budget_bytes);
+
+    void push(const Chip8State& state);
+    // Drops the newest state and writes the one before it to state.
+    // Returns false, leaving state alone, when there is none.
+    bool stepBack(Chip8State& state);
+    void clear();
+
+    // states that stepBack can still return
+    std::size_t frames() const;
+    // bytes of the ring in use
+    std::size_t bytesUsed() const;
+
+    private:
+    static constexpr std::size_t state_size = sizeof(Chip8State);
+
+    std::size_t encode(const uint8_t* older, const uint8_t* newer);
+    void decode(std::size_t record_start, uint32_t length, uint8_t* newer);
+
+    void writeRing(std::size_t position, const uint8_t* data, std::size_t length);
+    void readRing(std::size_t position, uint8_t* data, std::size_t length) const;
+    uint32_t readLength(std::size_t position) const;
+    void dropOldest();
+
+    std::vector<uint8_t> ring;
+    std::size_t oldest = 0; // ring offset of the oldest record
+    std::size_t used = 0;
+    std::size_t records = 0;
+
+    bool has_newest = false;
+    std::vector<uint8_t> newest; // the newest state, whole
+    std::vector<uint8_t> scratch; // the record being encoded
+};
@@ -0,0 +1,42 @@
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "core/chip8.h"
+
+// libFuzzer entry point: every input is a ROM, run for a second of emulated
+// time from the same clean machine. The machine is built once and reset
+// between inputs by restoring a snapshot, which copies the state back after
+// comparing memory in chunks to drop the cached code of the last input. No
+// machine is rebuilt, which keeps the executions per second high.
+//
+// The core prints unhandled opcodes and beeps, run with -close_fd_mask=1.
+
+namespace {
+    constexpr int ticks_per_input = 60;
+
+    struct Harness {
+        Harness() {
+            chip.setSeed(0);
+            clean = chip.snapshot();
+        }
+
+        Chip8 chip;
+        Chip8State clean;
+        std::vector<uint8_t> program;
+    };
+} // Anonymous namespace
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t* data, std::size_t size) {
+    static Harness harness;
+    Chip8& chip = harness.chip;
+
+    chip.restore(harness.clean);
+    harness.program.assign(data, data + size);
+    chip.loadProgram(harness.program);
+
+    for(int tick = 0; tick < ticks_per_input && chip.isRunning() && !chip.isHalted(); tick++) {
+        chip.runTick();
+    }
+    return 0;
+}
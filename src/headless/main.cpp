@@ -0,0 +1,247 @@
+#undef _UNICODE
+#include <getopt.h>
+#ifndef _MSC_VER
+#include <unistd.h>
+#endif
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <memory>
+#include <optional>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <fmt/core.h>
+
+#include "core/chip8.h"
+#include "core/clock.h"
+#include "core/input_script.h"
+#include "core/loader.h"
+#include "core/movie.h"
+#include "core/pacer.h"
+
+namespace {
+    const char* exitReasonName(ExitReason reason) {
+        switch (reason) {
+            case ExitReason::None:
+                return "none";
+            case ExitReason::Finished:
+                return "finished";
+            case ExitReason::Shutdown:
+                return "shutdown";
+            case ExitReason::Error:
+                return "error";
+            case ExitReason::StackOverflow:
+                return "stack overflow";
+            case ExitReason::StackUnderflow:
+                return "stack underflow";
+        }
+        return "unknown";
+    }
+
+    void printHelp(const char* argv0) {
+        fmt::print("Usage: {} [options] <filename>\n"
+                   "Runs a CHIP-8 program without a window and prints a summary\n"
+                   "-h, --help            Display this help text and exit\n"
+                   "--frames=<n>          Frames (60 Hz timer ticks) to run, default 600 or the whole movie\n"
+                   "--timeout=<seconds>   Stop after this much real time\n"
+                   "--uncapped            Run as fast as possible instead of in real time\n"
+                   "--seed=<n>            Seed of the random number generator\n"
+                   "--input=<file>        Key script, lines of <frame> <key 0-F> <down|up>\n"
+                   "--record=<movie>      Record the key presses of the run\n"
+                   "--play=<movie>        Play a session recorded by pof or pof-headless back, as fast as possible\n"
+                   "--frequency=<hz>      Instructions per second, default 700\n"
+                   "--cpu=<backend>       CPU backend: switch (default), threaded or jit\n"
+                   "--quirks=<profile>    CHIP-8 variant: modern (default), cosmac or schip\n",
+                   argv0);
+    }
+} // Anonymous namespace
+
+int main(int argc, char* args[]) {
+    int option_index = 0;
+
+    Chip8 chip;
+    std::string filename;
+    std::optional<uint64_t> frames;
+    double timeout = 0;
+    bool uncapped = false;
+    std::vector<InputEvent> input;
+    std::string record_file;
+    std::string play_file;
+    Movie movie;
+    std::optional<uint32_t> seed;
+
+    static struct option long_options[] = {
+        {"help", no_argument, 0, 'h'},
+        {"frames", required_argument, 0, 'f'},
+        {"timeout", required_argument, 0, 't'},
+        {"uncapped", no_argument, 0, 'u'},
+        {"seed", required_argument, 0, 's'},
+        {"input", required_argument, 0, 'i'},
+        {"record", required_argument, 0, 'r'},
+        {"play", required_argument, 0, 'p'},
+        {"frequency", required_argument, 0, 'F'},
+        {"cpu", required_argument, 0, 'c'},
+        {"quirks", required_argument, 0, 'q'},
+        {0, 0, 0, 0},
+    };
+
+    while (optind < argc) {
+        int arg = getopt_long(argc, args, "h", long_options, &option_index);
+        if (arg != -1) {
+            switch (static_cast<char>(arg)) {
+            case 'h':
+                printHelp(args[0]);
+                return 0;
+            case 'f':
+                frames = std::strtoull(optarg, nullptr, 10);
+                break;
+            case 't':
+                timeout = std::strtod(optarg, nullptr);
+                break;
+            case 'u':
+                uncapped = true;
+                break;
+            case 's':
+                seed = static_cast<uint32_t>(std::strtoul(optarg, nullptr, 10));
+                break;
+            case 'i':
+                if (!readInputScript(optarg, input)) {
+                    return -1;
+                }
+                break;
+            case 'r':
+                record_file = optarg;
+                break;
+            case 'p':
+                play_file = optarg;
+                break;
+            case 'F':
+                movie.frequency = std::max(1, std::atoi(optarg));
+                break;
+            case 'c': {
+                const auto backend = cpuBackendFromName(optarg);
+                if (!backend) {
+                    fmt::print("Unknown cpu backend {}\n", optarg);
+                    printHelp(args[0]);
+                    return -1;
+                }
+                chip.setCpuBackend(*backend);
+                break;
+            }
+            case 'q': {
+                const auto quirks = quirksFromName(optarg);
+                if (!quirks) {
+                    fmt::print("Unknown quirks profile {}\n", optarg);
+                    printHelp(args[0]);
+                    return -1;
+                }
+                movie.quirks = *quirks;
+                break;
+            }
+            default:
+                printHelp(args[0]);
+                return -1;
+            }
+        } else {
+            filename = args[optind];
+            optind++;
+        }
+    }
+
+    if (filename.empty()) {
+        fmt::print("Filename not provided. Printing help.\n");
+        printHelp(args[0]);
+        return 0;
+    }
+
+    if (!play_file.empty() && (!record_file.empty() || !input.empty())) {
+        fmt::print("A movie plays back alone, without --record or --input\n");
+        return -1;
+    }
+
+    const std::vector<uint8_t> program = readChip8Program(filename);
+    std::unique_ptr<MoviePlayer> player;
+    if (!play_file.empty()) {
+        if (!readMovie(play_file, movie)) {
+            return -1;
+        }
+        if (movie.rom_hash != romHash(program)) {
+            fmt::print("{} was recorded with a different ROM\n", play_file);
+            return -1;
+        }
+        player = std::make_unique<MoviePlayer>(movie);
+    }
+    else {
+        movie.seed = seed.value_or(std::random_device{}());
+        movie.rom_hash = romHash(program);
+    }
+    setUpForMovie(chip, movie);
+    if (!record_file.empty()) {
+        chip.startRecording(movie);
+    }
+    chip.loadProgram(program);
+
+    using namespace std::chrono;
+    VirtualClock virtual_clock;
+    // a movie carries its own timing, so playing it back does not wait for the wall clock
+    FramePacer pacer(uncapped || player ? static_cast<Clock&>(virtual_clock) : realTimeClock());
+    const auto start = steady_clock::now();
+    const auto elapsed = [&start] {
+        return duration<double>(steady_clock::now() - start).count();
+    };
+
+    uint64_t frame = 0;
+    uint64_t instructions = 0;
+    auto next_input = input.begin();
+    const char* stopped_by = player && !frames ? "end of movie" : "frame count";
+    // a movie plays to its end unless the frames are given
+    const auto finished = [&] {
+        return frames ? frame >= *frames : player ? chip.cycles() >= movie.length : frame >= 600;
+    };
+    for (; !finished(); frame++) {
+        for (; next_input != input.end() && next_input->frame <= frame; ++next_input) {
+            chip.setKey(next_input->key, next_input->pressed);
+        }
+        if (player) {
+            player->apply(chip);
+        }
+        instructions += chip.runTick().cycles;
+        if (!chip.isRunning()) {
+            stopped_by = exitReasonName(chip.exitReason());
+            frame++;
+            break;
+        }
+        if (chip.isHalted() && !(player && !player->finished())) {
+            stopped_by = "halt";
+            frame++;
+            break;
+        }
+        if (timeout > 0 && elapsed() >= timeout) {
+            stopped_by = "timeout";
+            frame++;
+            break;
+        }
+        pacer.waitForNextTick();
+    }
+
+    const double seconds = elapsed();
+    if (!record_file.empty()) {
+        chip.stopRecording();
+        movie.length = chip.cycles();
+        if (!writeMovie(record_file, movie)) {
+            return -1;
+        }
+    }
+    fmt::print("frames: {}\n", frame);
+    fmt::print("stopped by: {}\n", stopped_by);
+    fmt::print("instructions: {}\n", instructions);
+    fmt::print("instructions per second: {:.0f}\n", seconds > 0 ? instructions / seconds : 0.0);
+    fmt::print("framebuffer hash: {:016x}\n", chip.frameHash());
+
+    return chip.exitReason() == ExitReason::Error || chip.exitReason() == ExitReason::StackOverflow
+        || chip.exitReason() == ExitReason::StackUnderflow ? 1 : 0;
+}
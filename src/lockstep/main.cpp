@@ -0,0 +1,454 @@
+#undef _UNICODE
+#include <getopt.h>
+#ifndef _MSC_VER
+#include <unistd.h>
+#endif
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <iterator>
+#include <memory>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include <fmt/core.h>
+
+#include "core/aot.h"
+#include "core/batch.h"
+#include "core/chip8.h"
+#include "core/expected_state.h"
+#include "core/input_script.h"
+#include "core/reference.h"
+
+namespace {
+    struct Options {
+        uint64_t frames = 600;
+        uint32_t block = 64;
+        CpuBackend backend = CpuBackend::Switch;
+        Quirks quirks = default_quirks;
+        int frequency = 0; // 0 keeps the core default
+        uint32_t seed = 0;
+        std::vector<InputEvent> input;
+        const AotProgram* aot = nullptr; // replaces backend
+        std::size_t lanes = 0; // checks a batch of this many lanes instead
+    };
+
+    // Compares everything an instruction can change. The cycle clock is left
+    // out, the tester keeps time for both machines.
+    bool sameState(const Chip8State& a, const Chip8State& b) {
+        return a.pc == b.pc && a.I_reg == b.I_reg
+            && std::equal(std::begin(a.VX_reg), std::end(a.VX_reg), std::begin(b.VX_reg))
+            && a.delay_timer == b.delay_timer && a.sound_timer == b.sound_timer
+            && a.stack_size == b.stack_size
+            && std::equal(a.stack.begin(), a.stack.begin() + std::min<std::size_t>(a.stack_size, a.stack.size()), b.stack.begin())
+            && a.emulated_memory == b.emulated_memory && a.framebuffer == b.framebuffer
+            && a.randy == b.randy;
+    }
+
+    bool sameState(const Chip8& chip, const ReferenceChip8& reference) {
+        return sameState(chip.snapshot(), reference.state())
+            && chip.isRunning() == (reference.exitReason() == ExitReason::None);
+    }
+
+    // Runs the reference over the instructions the core retired. A core that
+    // stopped did not retire the instruction that trapped, or failed to
+    // fetch, so the reference has to run into it too.
+    void catchUp(ReferenceChip8& reference, uint32_t retired, const Chip8& chip) {
+        for(uint32_t i = 0; i < retired && reference.step(); i++) {
+        }
+        if(!chip.isRunning()) {
+            reference.step();
+        }
+    }
+
+    // a row of a table with a column for each machine
+    void field(const std::string& name, uint64_t a, uint64_t b, int width) {
+        fmt::print("  {:<10}  {:0{}X}{:>{}}{:0{}X}{}\n", name, a, width, "", std::max(8 - width, 1), b, width,
+                   a != b ? "  <<" : "");
+    }
+
+    void printDifferences(const Chip8State& core, const Chip8State& reference,
+                          const char* core_name = "core", const char* reference_name = "reference") {
+        fmt::print("              {:<8}{}\n", core_name, reference_name);
+        field("pc", core.pc, reference.pc, 3);
+        field("I", core.I_reg, reference.I_reg, 3);
+        for(int x = 0; x < 16; x++) {
+            field(fmt::format("V{:X}", x), core.VX_reg[x], reference.VX_reg[x], 2);
+        }
+        field("DT", core.delay_timer, reference.delay_timer, 2);
+        field("ST", core.sound_timer, reference.sound_timer, 2);
+        field("SP", core.stack_size, reference.stack_size, 2);
+        for(std::size_t i = 0; i < core.stack.size(); i++) {
+            if(i < std::max(core.stack_size, reference.stack_size)) {
+                field(fmt::format("stack[{}]", i), core.stack[i], reference.stack[i], 3);
+            }
+        }
+        int listed = 0;
+        for(std::size_t address = 0; address < core.emulated_memory.size(); address++) {
+            if(core.emulated_memory[address] != reference.emulated_memory[address] && listed++ < 16) {
+                field(fmt::format("[{:03X}]", address), core.emulated_memory[address],
+                      reference.emulated_memory[address], 2);
+            }
+        }
+        if(listed > 16) {
+            fmt::print("  ... {} more memory bytes differ\n", listed - 16);
+        }
+        for(unsigned y = 0; y < nHeight; y++) {
+            if(core.framebuffer[y] != reference.framebuffer[y]) {
+                fmt::print("  row {:<6}  {:016X}\n              {:016X}\n", y, core.framebuffer[y], reference.framebuffer[y]);
+            }
+        }
+        if(core.randy != reference.randy) {
+            fmt::print("  the random number generators differ\n");
+        }
+    }
+
+    // Puts the machine under test in state, running on the backend of the options
+    void setUp(Chip8& chip, const Chip8State& state, const Options& options) {
+        chip.setQuirks(options.quirks);
+        chip.setCpuBackend(options.backend);
+        chip.restore(state);
+        // the plugin checks it was translated from the program in memory
+        if(options.aot) {
+            chip.setAotProgram(*options.aot);
+        }
+    }
+
+    Chip8State cleanState(const std::vector<uint8_t>& program, const Options& options) {
+        Chip8 chip;
+        chip.setQuirks(options.quirks);
+        chip.setSeed(options.seed);
+        if(options.frequency > 0) {
+            chip.setCoreFrequency(options.frequency);
+        }
+        chip.loadProgram(program);
+        return chip.snapshot();
+    }
+
+    // Runs the block that diverged again from the state before it, one
+    // instruction at a time, to find the first instruction the two disagree on
+    void reportDivergence(const Chip8State& before, uint32_t cycles, const Chip8& chip,
+                          const ReferenceChip8& reference, const Options& options) {
+        Chip8 replay;
+        setUp(replay, before, options);
+        ReferenceChip8 replay_reference(before, options.quirks);
+        for(uint32_t i = 0; i < cycles; i++) {
+            const uint16_t pc = replay.snapshot().pc;
+            const Chip8State& state = replay_reference.state();
+            const unsigned opcode = state.emulated_memory[pc % 4096] << 8 | state.emulated_memory[(pc + 1) % 4096];
+            catchUp(replay_reference, replay.run(1, 0).cycles, replay);
+            if(!sameState(replay, replay_reference)) {
+                fmt::print("  diverged at {:03X}: {:04X}, instruction {} of the block\n", pc, opcode, i + 1);
+                printDifferences(replay.snapshot(), replay_reference.state());
+                return;
+            }
+        }
+        // superinstructions and translated blocks only run with a larger budget
+        fmt::print("  diverged in the block of {} instructions from {:03X}, which runs the same one instruction at a time\n",
+                   cycles, before.pc);
+        printDifferences(chip.snapshot(), reference.state());
+    }
+
+    // The state <rom>.expected says the program halts in, if the file is
+    // there and was recorded on the run the options make. Returns false
+    // if it cannot be read.
+    bool readExpected(const std::string& filename, const Chip8State& clean, const Options& options,
+                      std::optional<ExpectedState>& expected) {
+        const std::string expected_file = filename + ".expected";
+        if(!std::ifstream(expected_file).is_open()) {
+            return true;
+        }
+        ExpectedState state;
+        if(!readExpectedState(expected_file, state)) {
+            return false;
+        }
+        if(state.quirks == options.quirks && state.frequency == clean.clock.frequency() && options.seed == 0
+           && options.input.empty()) {
+            expected = state;
+        } else {
+            fmt::print("note      {}: {} was recorded with other quirks, frequency, seed or input, it is left out\n",
+                       filename, expected_file);
+        }
+        return true;
+    }
+
+    // Whether the core halted where <rom>.expected says. The tick it halts
+    // in is not compared, the core notices a halt between blocks while
+    // pof-romgen only looks at the start of a tick.
+    bool matchesExpected(const std::string& filename, const Chip8& chip, const ExpectedState& expected) {
+        if(!chip.isHalted()) {
+            fmt::print("MISMATCH  {}: did not halt, {}.expected halts in tick {}\n", filename, filename, expected.ticks);
+            return false;
+        }
+        ExpectedState reached = expected;
+        setExpectedState(reached, chip.snapshot());
+        if(reached.pc == expected.pc && reached.I_reg == expected.I_reg && reached.VX_reg == expected.VX_reg
+           && reached.frame_hash == expected.frame_hash && reached.memory_hash == expected.memory_hash) {
+            return true;
+        }
+        fmt::print("MISMATCH  {}: halted in another state than {}.expected\n", filename, filename);
+        fmt::print("              core    expected\n");
+        field("pc", reached.pc, expected.pc, 3);
+        field("I", reached.I_reg, expected.I_reg, 3);
+        for(int x = 0; x < 16; x++) {
+            field(fmt::format("V{:X}", x), reached.VX_reg[x], expected.VX_reg[x], 2);
+        }
+        field("frame", reached.frame_hash, expected.frame_hash, 16);
+        field("memory", reached.memory_hash, expected.memory_hash, 16);
+        return false;
+    }
+
+    // Runs a batch and one Chip8 per lane, each lane stepped with
+    // fetchDecodeExecute. Lane n draws random numbers from stream n like the
+    // batch, and presses keys of its own besides the script so that the
+    // lanes split up.
+    bool runLanes(const std::string& filename, const std::vector<uint8_t>& program, const Options& options,
+                  uint64_t& instructions) {
+        Chip8State clean = cleanState(program, options);
+        CycleClock clock = clean.clock;
+        Chip8Batch batch(options.lanes, options.quirks);
+        batch.setSeed(options.seed);
+        batch.loadProgram(program);
+        std::vector<std::unique_ptr<Chip8>> chips;
+        std::vector<Pcg32> presses;
+        for(std::size_t lane = 0; lane < options.lanes; lane++) {
+            clean.randy = Pcg32(options.seed, lane);
+            chips.push_back(std::make_unique<Chip8>());
+            chips.back()->setQuirks(options.quirks);
+            chips.back()->restore(clean);
+            presses.emplace_back(options.seed + 1, lane);
+        }
+
+        const auto anyRunning = [&] {
+            return std::any_of(chips.begin(), chips.end(), [](const auto& chip) { return chip->isRunning(); });
+        };
+        auto next_input = options.input.begin();
+        for(uint64_t frame = 0; frame < options.frames && anyRunning(); frame++) {
+            for(; next_input != options.input.end() && next_input->frame <= frame; ++next_input) {
+                for(std::size_t lane = 0; lane < options.lanes; lane++) {
+                    chips[lane]->setKey(next_input->key, next_input->pressed);
+                    batch.setKey(lane, next_input->key, next_input->pressed);
+                }
+            }
+            for(std::size_t lane = 0; lane < options.lanes; lane++) {
+                if(presses[lane]() % 4 == 0) {
+                    const uint32_t press = presses[lane]();
+                    const uint8_t key = press & 0xF;
+                    const bool pressed = (press >> 4) & 1;
+                    chips[lane]->setKey(key, pressed);
+                    batch.setKey(lane, key, pressed);
+                }
+            }
+            bool ticked = false;
+            while(!ticked) {
+                const uint32_t cycles = std::min(options.block, clock.cyclesUntilTick());
+                batch.tickCPU(cycles);
+                for(const auto& chip : chips) {
+                    for(uint32_t i = 0; i < cycles && chip->isRunning(); i++) {
+                        chip->fetchDecodeExecute();
+                    }
+                }
+                instructions += uint64_t{cycles} * options.lanes;
+                for(std::size_t lane = 0; lane < options.lanes; lane++) {
+                    const Chip8State expected = chips[lane]->snapshot();
+                    const Chip8State state = batch.laneState(lane);
+                    if(!sameState(expected, state) || chips[lane]->isRunning() != batch.isRunning(lane)) {
+                        fmt::print("MISMATCH  {}: lane {}, frame {}\n", filename, lane, frame);
+                        printDifferences(expected, state, "Chip8", "batch");
+                        return false;
+                    }
+                }
+                ticked = clock.advance(cycles);
+            }
+            for(const auto& chip : chips) {
+                chip->tickDelayTimer();
+                chip->tickSoundTimer();
+            }
+            batch.tickTimers();
+        }
+        return true;
+    }
+
+    // returns whether the core and the reference agreed to the end
+    bool runLockstep(const std::string& filename, const Options& options, uint64_t& instructions) {
+        std::ifstream file(filename, std::ios::in | std::ios::binary);
+        if(!file.is_open()) {
+            fmt::print("ERROR     {}: could not open it\n", filename);
+            return false;
+        }
+        const std::vector<uint8_t> program{std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>()};
+        if(options.aot && !std::equal(program.begin(), program.end(), options.aot->rom, options.aot->rom + options.aot->rom_size)) {
+            fmt::print("ERROR     {}: the AOT plugin was translated from a different program\n", filename);
+            return false;
+        }
+
+        if(options.lanes > 0) {
+            return runLanes(filename, program, options, instructions);
+        }
+
+        const Chip8State clean = cleanState(program, options);
+        std::optional<ExpectedState> expected;
+        if(!readExpected(filename, clean, options, expected)) {
+            return false;
+        }
+        Chip8 chip;
+        setUp(chip, clean, options);
+        ReferenceChip8 reference(clean, options.quirks);
+        CycleClock clock = clean.clock;
+
+        // long enough to reach the expected halt
+        const uint64_t frames = expected ? std::max(options.frames, expected->ticks) : options.frames;
+        auto next_input = options.input.begin();
+        for(uint64_t frame = 0; frame < frames && chip.isRunning() && !chip.isHalted(); frame++) {
+            for(; next_input != options.input.end() && next_input->frame <= frame; ++next_input) {
+                chip.setKey(next_input->key, next_input->pressed);
+                reference.setKey(next_input->key, next_input->pressed);
+            }
+            bool ticked = false;
+            while(!ticked && chip.isRunning()) {
+                const Chip8State before = chip.snapshot();
+                const uint32_t cycles = chip.run(std::min(options.block, clock.cyclesUntilTick()), 0).cycles;
+                catchUp(reference, cycles, chip);
+                instructions += cycles;
+                if(!sameState(chip, reference)) {
+                    fmt::print("MISMATCH  {}: frame {}\n", filename, frame);
+                    reportDivergence(before, cycles, chip, reference, options);
+                    return false;
+                }
+                ticked = clock.advance(cycles);
+            }
+            chip.tickDelayTimer();
+            chip.tickSoundTimer();
+            reference.tickTimers();
+        }
+        return !expected || matchesExpected(filename, chip, *expected);
+    }
+
+    void printHelp(const char* argv0) {
+        fmt::print("Usage: {} [options] <rom>...\n"
+                   "Runs each ROM on a core backend and on a plain reference interpreter side by side,\n"
+                   "and stops at the first state they disagree on. A ROM with a <rom>.expected from\n"
+                   "pof-romgen also has to halt in the state the file holds\n"
+                   "-h, --help            Display this help text and exit\n"
+                   "--frames=<n>          Frames (60 Hz timer ticks) to run, default 600\n"
+                   "--block=<n>           Instructions between comparisons, default 64\n"
+                   "--seed=<n>            Seed of the random number generator\n"
+                   "--input=<file>        Key script, lines of <frame> <key 0-F> <down|up>\n"
+                   "--frequency=<hz>      Instructions per second, default 700\n"
+                   "--cpu=<backend>       CPU backend: switch (default), threaded or jit\n"
+                   "--aot=<plugin>        Run blocks translated by pof-aot from the same ROM instead\n"
+                   "--lanes=<n>           Check a batch of n lanes against one machine per lane instead\n"
+                   "--quirks=<profile>    CHIP-8 variant: modern (default), cosmac or schip\n",
+                   argv0);
+    }
+} // Anonymous namespace
+
+int main(int argc, char* args[]) {
+    int option_index = 0;
+
+    Options options;
+    std::vector<std::string> filenames;
+
+    static struct option long_options[] = {
+        {"help", no_argument, 0, 'h'},
+        {"frames", required_argument, 0, 'f'},
+        {"block", required_argument, 0, 'b'},
+        {"seed", required_argument, 0, 's'},
+        {"input", required_argument, 0, 'i'},
+        {"frequency", required_argument, 0, 'F'},
+        {"cpu", required_argument, 0, 'c'},
+        {"quirks", required_argument, 0, 'q'},
+        {"aot", required_argument, 0, 'a'},
+        {"lanes", required_argument, 0, 'l'},
+        {0, 0, 0, 0},
+    };
+
+    while (optind < argc) {
+        int arg = getopt_long(argc, args, "h", long_options, &option_index);
+        if (arg != -1) {
+            switch (static_cast<char>(arg)) {
+            case 'h':
+                printHelp(args[0]);
+                return 0;
+            case 'f':
+                options.frames = std::strtoull(optarg, nullptr, 10);
+                break;
+            case 'b':
+                options.block = std::max(1, std::atoi(optarg));
+                break;
+            case 's':
+                options.seed = static_cast<uint32_t>(std::strtoul(optarg, nullptr, 10));
+                break;
+            case 'i':
+                if (!readInputScript(optarg, options.input)) {
+                    return -1;
+                }
+                break;
+            case 'F':
+                options.frequency = std::atoi(optarg);
+                break;
+            case 'c': {
+                const auto backend = cpuBackendFromName(optarg);
+                if (!backend) {
+                    fmt::print("Unknown cpu backend {}\n", optarg);
+                    printHelp(args[0]);
+                    return -1;
+                }
+                options.backend = *backend;
+                break;
+            }
+            case 'q': {
+                const auto quirks = quirksFromName(optarg);
+                if (!quirks) {
+                    fmt::print("Unknown quirks profile {}\n", optarg);
+                    printHelp(args[0]);
+                    return -1;
+                }
+                options.quirks = *quirks;
+                break;
+            }
+            case 'a':
+                options.aot = loadAotPlugin(optarg);
+                if (!options.aot) {
+                    return -1;
+                }
+                break;
+            case 'l':
+                options.lanes = std::strtoull(optarg, nullptr, 10);
+                break;
+            default:
+                printHelp(args[0]);
+                return -1;
+            }
+        } else {
+            filenames.assign(args + optind, args + argc);
+            break;
+        }
+    }
+
+    if (filenames.empty()) {
+        fmt::print("No ROMs provided. Printing help.\n");
+        printHelp(args[0]);
+        return 0;
+    }
+
+    std::size_t failed = 0;
+    for (const std::string& filename : filenames) {
+        uint64_t instructions = 0;
+        const auto start = std::chrono::steady_clock::now();
+        if (!runLockstep(filename, options, instructions)) {
+            failed++;
+            continue;
+        }
+        const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        fmt::print("ok        {}: {} instructions, {:.0f} instructions per second\n",
+                   filename, instructions, seconds > 0 ? instructions / seconds : 0.0);
+    }
+    fmt::print("{} of {} ROMs agree\n", filenames.size() - failed, filenames.size());
+
+    return failed == 0 ? 0 : 1;
+}
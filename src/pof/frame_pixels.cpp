@@ -0,0 +1,11 @@
+#include "frame_pixels.h"
+#include "core/chip8.h"
+
+void expandFrame(const Chip8& chip, uint32_t* pixels, uint32_t foreground, uint32_t background) {
+    for(uint8_t y = 0; y < nHeight; y++) {
+        const uint64_t row = chip.frameRow(y);
+        for(uint8_t x = 0; x < nWidth; x++) {
+            pixels[y*nWidth + x] = (row >> (nWidth - 1 - x)) & 1 ? foreground : background;
+        }
+    }
+}
@@ -0,0 +1,8 @@
+#pragma once
+
+#include <cstdint>
+
+class Chip8;
+
+// Writes the screen as nWidth*nHeight 32-bit pixels, row by row
+void expandFrame(const Chip8& chip, uint32_t* pixels, uint32_t foreground, uint32_t background);
@@ -11,14 +11,20 @@
 
 #include <fstream>
 #include <cstdint>
+#include <cstdlib>
+#include <optional>
+#include <random>
 #include <string>
 #include <thread>
 
 #include <fmt/core.h>
 
 #include "sdl_impl.h"
+#include "core/aot.h"
 #include "core/chip8.h"
+#include "core/clock.h"
 #include "core/loader.h"
+#include "core/movie.h"
 
 #ifdef _WIN32
 std::string UTF16ToUTF8(const std::wstring& input) {
@@ -41,7 +47,15 @@ std::string UTF16ToUTF8(const std::wstring& input) {
 
 static void printHelp(const char* argv0) {
     fmt::print("Usage: {} [options] <filename>\n"
-               "-h, --help            Display this help text and exit\n",
+               "-h, --help            Display this help text and exit\n"
+               "--cpu=<backend>       CPU backend: switch (default), threaded or jit\n"
+               "--aot=<plugin>        Run blocks translated by pof-aot from the same ROM\n"
+               "--quirks=<profile>    CHIP-8 variant: modern (default), cosmac or schip\n"
+               "--seed=<n>            Seed of the random number generator, random by default\n"
+               "--record=<movie>      Record the key presses of the session\n"
+               "--play=<movie>        Play a recorded session back instead of reading keys\n"
+               "--uncapped            Run as fast as possible instead of in real time\n"
+               "--rewind[=<KiB>]      Keep past frames to rewind with backspace, in 4096 KiB or the memory given\n",
                argv0);
 }
 
@@ -59,12 +73,28 @@ int main(int argc, char* args[]) {
     }
 #endif
 
-    std::unique_ptr<SDL_impl> impl{std::make_unique<SDL_impl>()};
+    Chip8 chip;
+    std::unique_ptr<SDL_impl> impl{std::make_unique<SDL_impl>(chip)};
     std::string filename;
+    std::string aot_plugin;
+    std::string record_file;
+    std::string play_file;
+    bool uncapped = false;
+    std::size_t rewind_kib = 0;
+    Movie movie;
+    std::optional<uint32_t> seed;
 
     static struct option long_options[] = {
         {"slow", no_argument, 0, 's'},
         {"help", no_argument, 0, 'h'},
+        {"cpu", required_argument, 0, 'c'},
+        {"aot", required_argument, 0, 'a'},
+        {"quirks", required_argument, 0, 'q'},
+        {"seed", required_argument, 0, 'S'},
+        {"record", required_argument, 0, 'r'},
+        {"play", required_argument, 0, 'p'},
+        {"uncapped", no_argument, 0, 'u'},
+        {"rewind", optional_argument, 0, 'R'},
         {0, 0, 0, 0},
     };
 
@@ -73,11 +103,49 @@ int main(int argc, char* args[]) {
         if (arg != -1) {
             switch (static_cast<char>(arg)) {
             case 's':
-                global_chip.setCoreFrequency(350); // 350Hz, 2.857ms
+                movie.frequency = 350; // 350Hz, 2.857ms
                 break;
             case 'h':
                 printHelp(args[0]);
                 return 0;
+            case 'c': {
+                const auto backend = cpuBackendFromName(optarg);
+                if (!backend) {
+                    fmt::print("Unknown cpu backend {}\n", optarg);
+                    printHelp(args[0]);
+                    return -1;
+                }
+                chip.setCpuBackend(*backend);
+                break;
+            }
+            case 'a':
+                aot_plugin = optarg;
+                break;
+            case 'q': {
+                const auto quirks = quirksFromName(optarg);
+                if (!quirks) {
+                    fmt::print("Unknown quirks profile {}\n", optarg);
+                    printHelp(args[0]);
+                    return -1;
+                }
+                movie.quirks = *quirks;
+                break;
+            }
+            case 'S':
+                seed = static_cast<uint32_t>(std::strtoul(optarg, &endarg, 10));
+                break;
+            case 'r':
+                record_file = optarg;
+                break;
+            case 'p':
+                play_file = optarg;
+                break;
+            case 'u':
+                uncapped = true;
+                break;
+            case 'R':
+                rewind_kib = optarg ? std::strtoul(optarg, &endarg, 10) : 4096;
+                break;
             }
         } else {
 #ifdef _WIN32
@@ -97,16 +165,67 @@ int main(int argc, char* args[]) {
         return 0;
     }
 
-    loadChip8Program(global_chip, filename);
+    if (!play_file.empty() && !record_file.empty()) {
+        fmt::print("Cannot record while playing a movie\n");
+        return -1;
+    }
+
+    const std::vector<uint8_t> program = readChip8Program(filename);
+    if (!play_file.empty()) {
+        if (!readMovie(play_file, movie)) {
+            return -1;
+        }
+        if (movie.rom_hash != romHash(program)) {
+            fmt::print("{} was recorded with a different ROM\n", play_file);
+            return -1;
+        }
+        chip.play(movie);
+    }
+    else {
+        // a recording needs the seed, which is random unless given
+        movie.seed = seed.value_or(std::random_device{}());
+        movie.rom_hash = romHash(program);
+    }
+    setUpForMovie(chip, movie);
+    if (!record_file.empty()) {
+        chip.startRecording(movie);
+    }
+    chip.loadProgram(program);
+    chip.enableRewind(rewind_kib * 1024);
+
+    VirtualClock virtual_clock;
+    if (uncapped) {
+        chip.setClock(virtual_clock);
+    }
+
+    if (!aot_plugin.empty()) {
+        const AotProgram* program = loadAotPlugin(aot_plugin);
+        if (program == nullptr) {
+            return -1;
+        }
+        chip.setAotProgram(*program);
+    }
 
     std::thread presentThready([&impl]{impl->Present();});
-    std::thread mainThready(&Chip8::mainLoop, &global_chip);
+    std::thread mainThready(&Chip8::mainLoop, &chip);
     while(impl->IsOpen()){
         impl->PollEvents();
     }
-    global_chip.shutDown();
+    chip.shutDown();
     mainThready.join();
     presentThready.join();
 
+    if (!record_file.empty()) {
+        chip.stopRecording();
+        movie.length = chip.cycles();
+        if (!writeMovie(record_file, movie)) {
+            return -1;
+        }
+    }
+
+    if (chip.exitReason() == ExitReason::Finished) {
+        fmt::print("Program finished\n");
+    }
+
     return 0;
 }
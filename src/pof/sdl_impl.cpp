@@ -6,6 +6,7 @@
 
 #include <fmt/core.h>
 
+#include "frame_pixels.h"
 #include "sdl_impl.h"
 #include "core/chip8.h"
 
@@ -34,7 +35,7 @@ namespace {
     };
 } // Anonymous namespace
 
-SDL_impl::SDL_impl(){
+SDL_impl::SDL_impl(Chip8& chip) : chip(chip) {
     background.r = 0;
     background.g = 0;
     background.b = 0;
@@ -84,24 +85,16 @@ SDL_impl::SDL_impl(){
 
 void SDL_impl::Present() {
     while (IsOpen()) {
-        if(global_chip.isFrameDirty()) {
-            global_chip.frame_mutex.lock();
+        if(chip.isFrameDirty()) {
+            chip.frame_mutex.lock();
             SDL_LockSurface(contentSurface);
-            uint32_t *underlying_buffer = static_cast<uint32_t*>(contentSurface->pixels);
-            for(int i=0; i < nHeight; i++){
-                for(int j=0; j < nWidth; j++){
-                    if(global_chip.frameAt(j,i)) {
-                        underlying_buffer[i*nWidth + j] = SDL_MapRGB(contentSurface->format, foreground.r, foreground.g, foreground.b);
-                    }
-                    else {
-                        underlying_buffer[i*nWidth + j] = SDL_MapRGB(contentSurface->format, background.r, background.g, background.b);
-                    }
-                }
-            }
+            expandFrame(chip, static_cast<uint32_t*>(contentSurface->pixels),
+                        SDL_MapRGB(contentSurface->format, foreground.r, foreground.g, foreground.b),
+                        SDL_MapRGB(contentSurface->format, background.r, background.g, background.b));
             SDL_UnlockSurface(contentSurface);
-            global_chip.frame_mutex.unlock();
+            chip.frame_mutex.unlock();
 
-            global_chip.clearDirty();
+            chip.clearDirty();
         }
 
         SDL_Surface *const screenSurface = SDL_GetWindowSurface( window );
@@ -141,7 +134,11 @@ void SDL_impl::PollEvents() {
         case SDL_KEYDOWN:
         case SDL_KEYUP:
             if(keymap.count(event.key.keysym.scancode) && !event.key.repeat) {
-                global_chip.setKey(keymap.at(event.key.keysym.scancode), (event.key.state == SDL_PRESSED));
+                chip.queueKey(keymap.at(event.key.keysym.scancode), (event.key.state == SDL_PRESSED));
+            }
+            // holding backspace plays the last frames backwards
+            if(event.key.keysym.scancode == SDL_SCANCODE_BACKSPACE && !event.key.repeat) {
+                chip.setRewinding(event.key.state == SDL_PRESSED);
             }
             break;
         case SDL_MOUSEBUTTONUP:
@@ -163,7 +160,7 @@ void SDL_impl::PollEvents() {
 }
 
 bool SDL_impl::IsOpen() {
-    return is_open && global_chip.isRunning();
+    return is_open && chip.isRunning();
 }
 
 SDL_impl::~SDL_impl(){
@@ -1,6 +1,7 @@
 
 #pragma once
 
+class Chip8;
 struct SDL_Window;
 struct SDL_Surface;
 
@@ -12,13 +13,15 @@ struct Color{
 
 class SDL_impl{
 public:
-    SDL_impl();
+    explicit SDL_impl(Chip8& chip);
     ~SDL_impl();
     
     void PollEvents();
     void Present();
     bool IsOpen();
 private:
+    Chip8& chip;
+
     bool is_open;
 
     Color bg;
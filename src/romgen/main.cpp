@@ -0,0 +1,433 @@
+#undef _UNICODE
+#include <getopt.h>
+#ifndef _MSC_VER
+#include <unistd.h>
+#endif
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <fmt/core.h>
+
+#include "core/chip8.h"
+#include "core/expected_state.h"
+#include "core/reference.h"
+
+// Generates CHIP-8 programs that stress one part of the core. A program
+// runs its workload in a counted loop and then halts in a jump to itself.
+// The state it halts in, as reached by the reference interpreter, is written
+// next to it so other backends and later versions can be checked against
+// it. The same options always give the same program.
+namespace {
+    constexpr uint16_t program_start = 0x200;
+    constexpr std::size_t max_program_size = 4096 - program_start;
+
+    // VD and VE count the loops, workloads only use V0 to VC and VF, which
+    // register operations also write to
+    constexpr uint8_t outer_counter = 0xD;
+    constexpr uint8_t inner_counter = 0xE;
+    constexpr uint8_t work_registers = 0xD;
+
+    // xorshift64*, the same sequence on every host
+    class Random {
+        public:
+        explicit Random(uint64_t seed) : state(seed * 0x9E3779B97F4A7C15u + 1) {}
+
+        uint32_t below(uint32_t bound) {
+            state ^= state >> 12;
+            state ^= state << 25;
+            state ^= state >> 27;
+            return static_cast<uint32_t>((state * 0x2545F4914F6CDD1Du) >> 32) % bound;
+        }
+
+        uint8_t workRegister() {
+            return below(work_registers);
+        }
+
+        private:
+        uint64_t state;
+    };
+
+    class RomBuilder {
+        public:
+        uint16_t here() const {
+            return program_start + code.size();
+        }
+
+        void emit(uint16_t opcode) {
+            code.push_back(opcode >> 8);
+            code.push_back(opcode & 0xFF);
+        }
+
+        void patch(uint16_t address, uint16_t opcode) {
+            code[address - program_start] = opcode >> 8;
+            code[address - program_start + 1] = opcode & 0xFF;
+        }
+
+        const std::vector<uint8_t>& bytes() const {
+            return code;
+        }
+
+        private:
+        std::vector<uint8_t> code;
+    };
+
+    uint16_t op(uint16_t high, uint8_t x, uint8_t nn) {
+        return high | x << 8 | nn;
+    }
+
+    uint16_t op(uint16_t high, uint8_t x, uint8_t y, uint8_t n) {
+        return high | x << 8 | y << 4 | n;
+    }
+
+    void emitAlu(RomBuilder& rom, Random& random) {
+        static constexpr uint8_t register_ops[] = {0x0, 0x1, 0x2, 0x3, 0x4, 0x5, 0x6, 0x7, 0xE};
+        const uint8_t x = random.workRegister();
+        switch (random.below(4)) {
+            case 0:
+                rom.emit(op(0x6000, x, random.below(256)));
+                break;
+            case 1:
+                rom.emit(op(0x7000, x, random.below(256)));
+                break;
+            default: {
+                // now and then into VF, where the result and the flag compete
+                const uint8_t destination = random.below(8) == 0 ? 0xF : x;
+                rom.emit(op(0x8000, destination, random.workRegister(), register_ops[random.below(std::size(register_ops))]));
+                break;
+            }
+        }
+    }
+
+    // Arithmetic and register moves only
+    void emitAluWorkload(RomBuilder& rom, Random& random, int length) {
+        for (int i = 0; i < length; i++) {
+            emitAlu(rom, random);
+        }
+    }
+
+    // Sprites of every height at positions that wrap and clip, from fonts and code
+    void emitSpriteWorkload(RomBuilder& rom, Random& random, int length) {
+        for (int i = 0; i < length; i++) {
+            const uint8_t x = random.below(4);
+            const uint8_t y = random.below(4);
+            switch (random.below(8)) {
+                case 0:
+                    rom.emit(op(0x6000, x, random.below(256)));
+                    break;
+                case 1:
+                    rom.emit(op(0x7000, y, random.below(256)));
+                    break;
+                case 2:
+                    rom.emit(0xA000 | random.below(0xFF0));
+                    break;
+                case 3:
+                    rom.emit(op(0xF029, x, 0));
+                    break;
+                case 4:
+                    if (random.below(8) == 0) {
+                        rom.emit(0x00E0);
+                        break;
+                    }
+                    [[fallthrough]];
+                default:
+                    rom.emit(op(0xD000, x, y, 1 + random.below(15)));
+                    break;
+            }
+        }
+    }
+
+    // Calls into a chain of subroutines up to 8 deep, the workload itself
+    // is a sequence of calls. The subroutines go after the halt.
+    void emitCallWorkload(RomBuilder& rom, Random& random, int length, std::vector<uint16_t>& call_sites) {
+        for (int i = 0; i < length; i++) {
+            if (random.below(3) == 0) {
+                emitAlu(rom, random);
+            }
+            else {
+                call_sites.push_back(rom.here());
+                rom.emit(0x2000);
+            }
+        }
+    }
+
+    void emitSubroutines(RomBuilder& rom, Random& random, const std::vector<uint16_t>& call_sites) {
+        constexpr int subroutines = 8;
+        std::vector<uint16_t> starts;
+        std::vector<uint16_t> nested_calls;
+        for (int s = 0; s < subroutines; s++) {
+            starts.push_back(rom.here());
+            const int length = 1 + random.below(6);
+            for (int i = 0; i < length; i++) {
+                emitAlu(rom, random);
+            }
+            // each subroutine may only call deeper ones, so the stack stays bounded
+            if (s + 1 < subroutines && random.below(2) == 0) {
+                nested_calls.push_back(rom.here());
+                rom.emit(0x2000 | (s + 1));
+            }
+            rom.emit(0x00EE);
+        }
+        for (const uint16_t site : nested_calls) {
+            const uint8_t callee = rom.bytes()[site - program_start + 1];
+            rom.patch(site, 0x2000 | starts[callee]);
+        }
+        for (const uint16_t site : call_sites) {
+            rom.patch(site, 0x2000 | starts[random.below(subroutines)]);
+        }
+    }
+
+    // Blocks that store V0 over the immediate of a 6XNN in a random block,
+    // often one that runs later in the same pass, so decoded and translated
+    // code keeps going stale
+    void emitSelfModifyingWorkload(RomBuilder& rom, Random& random, int length) {
+        constexpr uint16_t block_size = 10;
+        const uint16_t first = rom.here();
+        const int blocks = std::max(length / 5, 1);
+        for (int b = 0; b < blocks; b++) {
+            const uint16_t target = first + block_size * random.below(blocks) + 7;
+            const uint8_t x = 1 + random.below(work_registers - 1);
+            rom.emit(op(0x7000, 0, 1 + random.below(255))); // V0 += kk
+            rom.emit(0xA000 | target);                      // I = the immediate of a 6XNN
+            rom.emit(0xF055);                               // store V0 there
+            rom.emit(op(0x6000, x, 0));                     // VX = NN, rewritten
+            rom.emit(op(0x8004, 1 + random.below(work_registers - 1), x, 0x4)); // fold VX into another register
+        }
+    }
+
+    // Sets the delay timer and spins on it in the FX07 3X00 1NNN loop
+    void emitTimerWorkload(RomBuilder& rom, Random& random, int length) {
+        const int spins = std::max(length / 6, 1);
+        for (int i = 0; i < spins; i++) {
+            const uint8_t x = 1 + random.below(work_registers - 1);
+            rom.emit(op(0x6000, x, 1 + random.below(4)));
+            rom.emit(op(0xF015, x, 0));
+            const uint16_t head = rom.here();
+            rom.emit(op(0xF007, x, 0));
+            rom.emit(op(0x3000, x, 0));
+            rom.emit(0x1000 | head);
+            emitAlu(rom, random);
+        }
+    }
+
+    const char* kinds = "alu, sprite, call, selfmod or timer";
+
+    // Wraps the workload in loops run outer * inner times, ending in a halt
+    bool buildRom(const std::string& kind, uint64_t seed, int length, int iterations, RomBuilder& rom) {
+        Random random(seed);
+        const int outer = (iterations + 254) / 255;
+        const int inner = (iterations + outer - 1) / outer;
+
+        rom.emit(op(0x6000, outer_counter, 0));
+        const uint16_t outer_loop = rom.here();
+        rom.emit(op(0x6000, inner_counter, 0));
+        const uint16_t inner_loop = rom.here();
+
+        std::vector<uint16_t> call_sites;
+        if (kind == "alu") {
+            emitAluWorkload(rom, random, length);
+        }
+        else if (kind == "sprite") {
+            emitSpriteWorkload(rom, random, length);
+        }
+        else if (kind == "call") {
+            emitCallWorkload(rom, random, length, call_sites);
+        }
+        else if (kind == "selfmod") {
+            emitSelfModifyingWorkload(rom, random, length);
+        }
+        else if (kind == "timer") {
+            emitTimerWorkload(rom, random, length);
+        }
+        else {
+            fmt::print("Unknown kind {}, expected {}\n", kind, kinds);
+            return false;
+        }
+
+        rom.emit(op(0x7000, inner_counter, 1));
+        rom.emit(op(0x3000, inner_counter, inner));
+        rom.emit(0x1000 | inner_loop);
+        rom.emit(op(0x7000, outer_counter, 1));
+        rom.emit(op(0x3000, outer_counter, outer));
+        rom.emit(0x1000 | outer_loop);
+        const uint16_t halt = rom.here();
+        rom.emit(0x1000 | halt);
+
+        if (kind == "call") {
+            emitSubroutines(rom, random, call_sites);
+        }
+
+        if (rom.bytes().size() > max_program_size) {
+            fmt::print("The program needs {} bytes, more than fit in memory, use a smaller --length\n", rom.bytes().size());
+            return false;
+        }
+        return true;
+    }
+
+    struct RunLimits {
+        uint32_t frequency;
+        Quirks quirks;
+        uint64_t max_ticks;
+    };
+
+    // the halt Chip8 finds at the start of a tick: a jump to itself with the timers run out
+    bool halted(const Chip8State& state) {
+        return state.delay_timer == 0 && state.sound_timer == 0 && state.pc <= 4094
+            && (state.emulated_memory[state.pc] << 8 | state.emulated_memory[state.pc + 1]) == (0x1000 | state.pc);
+    }
+
+    // Runs the program to its halt on the reference interpreter, which shares
+    // no code with the backends checked against the file, and writes the
+    // state it ends in. Like Chip8::runTick, the tick the halt is found in
+    // still runs and counts.
+    bool recordExpectedState(const std::vector<uint8_t>& program, const RunLimits& limits, const std::string& header,
+                             const std::string& filename) {
+        // only places the font and the program
+        auto loader = std::make_unique<Chip8>();
+        loader->setSeed(0);
+        loader->setQuirks(limits.quirks);
+        loader->setCoreFrequency(limits.frequency);
+        loader->loadProgram(program);
+        const Chip8State start = loader->snapshot();
+
+        ReferenceChip8 reference(start, limits.quirks);
+        CycleClock clock = start.clock;
+        ExpectedState expected;
+        expected.frequency = limits.frequency;
+        expected.quirks = limits.quirks;
+        bool done = false;
+        while (!done && expected.ticks < limits.max_ticks) {
+            done = halted(reference.state());
+            const uint32_t cycles = clock.cyclesUntilTick();
+            for (uint32_t i = 0; i < cycles; i++) {
+                if (!reference.step()) {
+                    fmt::print("The program stopped at {:03X} before it halted\n", reference.state().pc);
+                    return false;
+                }
+            }
+            clock.advance(cycles);
+            reference.tickTimers();
+            expected.ticks++;
+            expected.instructions += cycles;
+        }
+        if (!done) {
+            fmt::print("The program did not halt within {} ticks\n", limits.max_ticks);
+            return false;
+        }
+
+        setExpectedState(expected, reference.state());
+        if (!writeExpectedState(filename, header, expected)) {
+            return false;
+        }
+        fmt::print("{} instructions over {} ticks\n", expected.instructions, expected.ticks);
+        return true;
+    }
+
+    void printHelp(const char* argv0) {
+        fmt::print("Usage: {} [options] <output.ch8>\n"
+                   "Generates a CHIP-8 program stressing one part of the core, and writes the\n"
+                   "state it halts in to <output.ch8>.expected\n"
+                   "-h, --help            Display this help text and exit\n"
+                   "--kind=<kind>         Workload: {} (default alu)\n"
+                   "--seed=<n>            Selects the program, default 1\n"
+                   "--length=<n>          Instructions in the workload, default 64\n"
+                   "--iterations=<n>      Times the workload runs, 1 to 65025, default 1000\n"
+                   "--frequency=<hz>      Instructions per second the state is recorded at, default 700\n"
+                   "--quirks=<profile>    CHIP-8 variant: modern (default), cosmac or schip\n",
+                   argv0, kinds);
+    }
+} // Anonymous namespace
+
+int main(int argc, char* args[]) {
+    int option_index = 0;
+
+    std::string kind = "alu";
+    uint64_t seed = 1;
+    int length = 64;
+    int iterations = 1000;
+    RunLimits limits{700, default_quirks, 10000000};
+    std::string output;
+
+    static struct option long_options[] = {
+        {"help", no_argument, 0, 'h'},
+        {"kind", required_argument, 0, 'k'},
+        {"seed", required_argument, 0, 's'},
+        {"length", required_argument, 0, 'l'},
+        {"iterations", required_argument, 0, 'i'},
+        {"frequency", required_argument, 0, 'F'},
+        {"quirks", required_argument, 0, 'q'},
+        {0, 0, 0, 0},
+    };
+
+    while (optind < argc) {
+        int arg = getopt_long(argc, args, "h", long_options, &option_index);
+        if (arg != -1) {
+            switch (static_cast<char>(arg)) {
+            case 'h':
+                printHelp(args[0]);
+                return 0;
+            case 'k':
+                kind = optarg;
+                break;
+            case 's':
+                seed = std::strtoull(optarg, nullptr, 10);
+                break;
+            case 'l':
+                length = std::max(std::atoi(optarg), 1);
+                break;
+            case 'i':
+                iterations = std::clamp(std::atoi(optarg), 1, 255 * 255);
+                break;
+            case 'F':
+                limits.frequency = std::max(std::atoi(optarg), 1);
+                break;
+            case 'q': {
+                const auto quirks = quirksFromName(optarg);
+                if (!quirks) {
+                    fmt::print("Unknown quirks profile {}\n", optarg);
+                    printHelp(args[0]);
+                    return -1;
+                }
+                limits.quirks = *quirks;
+                break;
+            }
+            default:
+                printHelp(args[0]);
+                return -1;
+            }
+        } else {
+            output = args[optind];
+            optind++;
+        }
+    }
+
+    if (output.empty()) {
+        fmt::print("Output filename not provided. Printing help.\n");
+        printHelp(args[0]);
+        return -1;
+    }
+
+    RomBuilder rom;
+    if (!buildRom(kind, seed, length, iterations, rom)) {
+        return -1;
+    }
+
+    std::ofstream file(output, std::ios::out | std::ios::binary);
+    file.write(reinterpret_cast<const char*>(rom.bytes().data()), rom.bytes().size());
+    if (!file) {
+        fmt::print("Could not write {}\n", output);
+        return -1;
+    }
+
+    const std::string header = fmt::format("# pof-romgen --kind={} --seed={} --length={} --iterations={}\n",
+                                           kind, seed, length, iterations);
+    if (!recordExpectedState(rom.bytes(), limits, header, output + ".expected")) {
+        return -1;
+    }
+    return 0;
+}